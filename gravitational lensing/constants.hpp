@@ -6,9 +6,13 @@
 #define c0          3e8                                             // speed of light in m/s
 #define G0          6.67e-11                                        // gravitational constant
 #define pi          M_PI                                            // math pi                                          
+#define arcsecToRad 4.8481e-6                                       // radians in one arcsecond
 #define FPS         120                                             // frames per second limit
 #define SHIFT       1                                               // shift param for lens center
 #define massSHIFT   0.025                                            // the degree of 10 that mass will be increased 
 #define fontSize    20                                              // size of the letter while rendering
 #define fontName    "resources/fonts/dejavu-sans-mono.ttf"          // path to the font
 #define saveImagesDirectory     "output_images/fitImages/"
+#define imageCacheDirectory     "cache/images/"                     // directory with decoded source images
+#define imageCacheSize          (1ull << 30)                        // the maximum size of the images cache in bytes
+#define tileCacheSize           64                                  // the maximum number of source tiles in memory
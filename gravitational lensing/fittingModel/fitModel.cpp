@@ -1,6 +1,9 @@
 #include <iostream>
+#include <optional>
 #include "../lensSolver.hpp"
 #include "../renderer.hpp"
+#include "../maskScorer.hpp"
+#include "../massUncertainty.hpp"
 
 sf::Image createSource(int width, int height, int x, int y, int r) {
     sf::RenderWindow window(sf::VideoMode(width, height), "source");
@@ -28,12 +31,21 @@ sf::Image createSource(int width, int height, int x, int y, int r) {
 class FitRenderer: public Renderer {
     sf::Image background;
 	bool showBackground;
+	std::optional<MaskScorer> scorer;	// compares rendered frames with the thresholded background
+
+	/**
+	 * @return number of pixels where the thresholded frame differs from the background
+	*/
+	uint64_t mismatch() {
+		return scorer->score(BitMask(pixels, width, height));
+	}
 public:
     FitRenderer(LensSolver *solver, sf::Image source, float realWidth, int dx, int dy, std::string backgroundImage, std::string title): Renderer(solver, source, realWidth, dx, dy, title), 
 																														showBackground(true)
     {
-        if (!background.loadFromFile(backgroundImage))
-    		throw std::runtime_error("Failed to open file.");
+		if (!background.loadFromFile(backgroundImage))
+			throw std::runtime_error("Failed to open file.");
+		scorer.emplace(BitMask::resampled(background.getPixelsPtr(), background.getSize().x, background.getSize().y, width, height));
     }
 
 	void keyboardHandle(sf::Event event, double maxMass, double step) {
@@ -72,7 +84,7 @@ public:
 
 		sf::Clock clock;
 		float currentTime;
-		window.setFramerateLimit(FPS);
+		window->setFramerateLimit(FPS);
 
 		void (Renderer::*update)();
 		update = &Renderer::reverseProcessImage;
@@ -84,6 +96,7 @@ public:
 		std::ostringstream omegaM_;
 		std::ostringstream omegaL_;
 		std::ostringstream einstAngle_;
+		std::ostringstream match_;
 		sourceZ << solver->getSourceRedshift();
 		lensZ << solver->getLensRedshift();
 		mass << solver->getMass();
@@ -93,6 +106,10 @@ public:
 		omegaM_ << omegaM;
 		omegaL_ << omegaL;
 
+		// the first frame is rendered before any event, so the match is shown from the start
+		(*this.*update)();
+		match_ << MaskScorer::matchPercent(mismatch(), scorer->getObserved().full());
+
 		std::string modelInfo = "H0: " + std::to_string(H0) + \
 								", omegaM: " + omegaM_.str() + \
 								", omegaL: " + omegaL_.str() + '\n' + \
@@ -100,15 +117,15 @@ public:
 							    "lens redshift: " + lensZ.str() + '\n' + \
 							    "scale: " + scale_.str() + " rad/pix";
 
-		while (window.isOpen())
+		while (window->isOpen())
     	{
 			currentTime = clock.restart().asSeconds();
 			sf::Event event;
 
-			while (window.pollEvent(event))
+			while (window->pollEvent(event))
 			{
 				if (event.type == sf::Event::Closed)
-					window.close();
+					window->close();
 				else if (event.type == sf::Event::KeyPressed)
 				{
 					keyboardHandle(event, maxMass, step);
@@ -117,14 +134,18 @@ public:
 					mass << solver->getMass();
 					einstAngle_.str("");
 					einstAngle_ << solver->getEinstainAngle();
+					match_.str("");
+					match_ << MaskScorer::matchPercent(mismatch(), scorer->getObserved().full());
 				}
                 else if (sf::Mouse::isButtonPressed(sf::Mouse::Left)){
 					mouseHandle();
                     (*this.*update)();
+					match_.str("");
+					match_ << MaskScorer::matchPercent(mismatch(), scorer->getObserved().full());
 				}
 			}
 
-            window.clear();
+            window->clear();
 
 			image.create(width, height, pixels);
 			image.createMaskFromColor(sf::Color::Black);
@@ -135,26 +156,58 @@ public:
             backSprite.setTexture(backTexture);
            
 			if (showBackground)
-            	window.draw(backSprite);
+            	window->draw(backSprite);
 
-			window.draw(sprite);
+			window->draw(sprite);
 
 			precText.setString(modelInfo +  '\n' + \
 							   "lens mass: " + mass.str() + " kg" + '\n' + \
 							   "einstain angle: " + einstAngle_.str() + " rad\n" + \
+							   "match: " + match_.str() + " %\n" + \
 							   "FPS: " + std::to_string(1 / currentTime) + '\n' \
 							    );
 			if (hideInfo) precText.setString("");
 			precText.setPosition(sf::Vector2f(10, 0));
-			window.draw(precText);
+			window->draw(precText);
 
-			window.display();
+			window->display();
     	}
 		return EXIT_SUCCESS;
     }
 };
 
-int main() {
+/**
+ * fits the mass to the mask for many bootstrap and noise perturbed realizations and prints confidence intervals
+ * 
+ * @param realizations number of bootstrap samples and of noise perturbed masks
+ * @param flipProbability probability of the mask pixel to be flipped in the noise perturbed masks
+*/
+int estimateMass(LensSolver *solver, std::string background, unsigned widthPix, unsigned heightPix, float realWidth,
+				 int sourceX, int sourceY, int radius, double minMass, double maxMass, double step, unsigned realizations,
+				 double flipProbability) {
+	sf::Image mask;
+	if (!mask.loadFromFile(background))
+		throw std::runtime_error("Failed to open file.");
+	BitMask observed = BitMask::resampled(mask.getPixelsPtr(), mask.getSize().x, mask.getSize().y, widthPix, heightPix);
+
+	std::vector<double> masses;
+	for (double mass = minMass; mass <= maxMass; mass *= std::pow(10, step))
+		masses.push_back(mass);
+
+	MassUncertainty engine(solver, observed, realWidth * 4.8481e-6 / widthPix, sourceX, sourceY,
+						   DiscSource{widthPix / 2.0, heightPix / 2.0, (double)radius}, masses);
+	MassEstimate bootstrap = engine.bootstrap(realizations);
+	MassEstimate noise = engine.perturb(realizations, flipProbability);
+
+	std::cout << "best mass: " << bootstrap.best << " kg" << std::endl;
+	std::cout << "bootstrap: " << bootstrap.median << " kg, 68% interval [" << bootstrap.lower << ", " << bootstrap.upper << "]" << std::endl;
+	std::cout << "noise:     " << noise.median << " kg, 68% interval [" << noise.lower << ", " << noise.upper << "]" << std::endl;
+	return EXIT_SUCCESS;
+}
+
+// ./fitModel --uncertainty 1000 [0.01] estimates the mass uncertainty over 1000 realizations instead of the interactive fit,
+// the optional argument is the probability of the pixel flip in the noise perturbed masks
+int main(int argc, char **argv) {
     float z1 = 0.227;
     float z2 = 0.9313;
     float width = 2.4241e-5;
@@ -166,13 +219,20 @@ int main() {
 	double lensY = 1.35262e-05;
 	int sourceX = -11;
 	int sourceY = 24;
+	int sourceRadius = 15;
 	double minMass = 2.2e41;
 	double maxMass = 2.8e41;
 	double step = 4e-3;
 	std::string background = "output_images/mask.png";
 	
 	auto solver = new LensSolver(minMass, z1, z2, lensX, lensY);
-	FitRenderer renderer(solver, createSource(widthPix, heightPix, widthPix/2, heightPix/2, 15), realWidth, sourceX, sourceY, background, "");
+	if ((argc == 3 || argc == 4) && std::string(argv[1]) == "--uncertainty") {
+		int code = estimateMass(solver, background, widthPix, heightPix, realWidth, sourceX, sourceY, sourceRadius,
+								minMass, maxMass, step, std::stoi(argv[2]), argc == 4 ? std::stod(argv[3]) : 0.01);
+		delete solver;
+		return code;
+	}
+	FitRenderer renderer(solver, createSource(widthPix, heightPix, widthPix/2, heightPix/2, sourceRadius), realWidth, sourceX, sourceY, background, "");
 	int code = renderer.poll(maxMass, step);
 	delete solver;
     return code;
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*
+ * cache entry format:
+ *   header      CacheHeader padded to CACHE_ALIGNMENT bytes (the path of the original file follows the structure)
+ *   pixels      width * height RGBA pixels, they start at the page boundary so can be mapped directly
+*/
+#define CACHE_MAGIC         0x434d494c      // "LIMC"
+#define CACHE_VERSION       1
+#define CACHE_ALIGNMENT     4096
+#define CACHE_STALE_AGE     3600            // age in seconds after which the temporary file is abandoned
+
+struct CacheHeader {
+    uint32_t magic, version;
+    uint32_t width, height;         // size of the image in pixels
+    uint64_t fileSize;              // size of the original file in bytes
+    int64_t fileTime;               // modification time of the original file
+    uint32_t pathLength;            // length of the path of the original file
+};
+
+/**
+ * decoded image mapped to the memory from the cache
+*/
+class MappedImage {
+protected:
+    void *data = MAP_FAILED;        // the mapped entry
+    size_t length = 0;              // size of the mapped entry in bytes
+    unsigned width = 0, height = 0; // size of the image in pixels
+
+public:
+    MappedImage() = default;
+    MappedImage(const MappedImage&) = delete;
+    MappedImage& operator=(const MappedImage&) = delete;
+
+    /**
+     * maps the cache entry
+     *
+     * @return true if the entry was mapped
+    */
+    bool map(std::string filename, unsigned width, unsigned height) {
+        unmap();
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        length = CACHE_ALIGNMENT + (size_t)width * height * 4;
+        data = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED)
+            return false;
+        this->width = width;
+        this->height = height;
+        return true;
+    }
+
+    void unmap() {
+        if (data != MAP_FAILED)
+            munmap(data, length);
+        data = MAP_FAILED;
+    }
+
+    /**
+     * @return RGBA pixels of the image
+    */
+    const uint8_t *pixels() {
+        return (const uint8_t *)data + CACHE_ALIGNMENT;
+    }
+
+    unsigned getWidth() {
+        return width;
+    }
+
+    unsigned getHeight() {
+        return height;
+    }
+
+    ~MappedImage() {
+        unmap();
+    }
+};
+
+/**
+ * persistent cache of decoded images. the entry is found by the path of the original file and is valid while
+ * the size and the modification time of the file stay the same. the least recently used entries are removed
+ * when the total size of the cache exceeds the limit
+*/
+class ImageCache {
+protected:
+    std::filesystem::path directory;    // directory with the cache entries
+    uint64_t maxSize;                   // the maximum total size of the entries in bytes
+
+    /**
+     * @return the path of the entry for the original file
+    */
+    std::filesystem::path entry(const std::string &path) {
+        uint64_t hash = 14695981039346656037ull;        // fnv-1a
+        for (unsigned char c : path)
+            hash = (hash ^ c) * 1099511628211ull;
+        std::stringstream ss;
+        ss << std::hex << std::setw(16) << std::setfill('0') << hash << ".raw";
+        return directory / ss.str();
+    }
+
+    /**
+     * @return the header the entry of the original file must have (zero size if the file doesn't exist)
+    */
+    CacheHeader expected(const std::string &path) {
+        std::error_code error;
+        CacheHeader header{CACHE_MAGIC, CACHE_VERSION, 0, 0, 0, 0, (uint32_t)path.size()};
+        header.fileSize = std::filesystem::file_size(path, error);
+        if (error)
+            header.fileSize = 0;
+        header.fileTime = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+        return header;
+    }
+
+    /**
+     * removes the least recently used entries while the cache is too big. the temporary files are counted too,
+     * the ones left by the crashed writers (older than CACHE_STALE_AGE seconds) are removed
+     *
+     * @param keep the entry that is never removed (the one which has just been stored)
+    */
+    void evict(const std::filesystem::path &keep) {
+        std::error_code error;
+        std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> entries;
+        uint64_t total = 0;
+        auto stale = std::filesystem::file_time_type::clock::now() - std::chrono::seconds(CACHE_STALE_AGE);
+        for (const auto &file : std::filesystem::directory_iterator(directory, error)) {
+            auto extension = file.path().extension();
+            if (extension == ".tmp" && file.last_write_time(error) < stale) {
+                std::filesystem::remove(file.path(), error);
+                continue;
+            }
+            if (extension != ".raw" && extension != ".tmp")
+                continue;
+            total += file.file_size(error);
+            if (extension == ".raw")
+                entries.push_back({file.last_write_time(error), file.path()});
+        }
+        std::sort(entries.begin(), entries.end());
+        for (auto &e : entries) {
+            if (total <= maxSize)
+                break;
+            if (e.second.filename() == keep.filename())
+                continue;
+            total -= std::filesystem::file_size(e.second, error);
+            std::filesystem::remove(e.second, error);
+        }
+    }
+
+public:
+    /**
+     * @param directory directory with the cache entries (it is created if it doesn't exist)
+     * @param maxSize the maximum total size of the entries in bytes
+    */
+    ImageCache(std::string directory, uint64_t maxSize): directory(directory), maxSize(maxSize) {
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+    }
+
+    /**
+     * maps the decoded image if it is in the cache. the stale entry is removed
+     *
+     * @param filename the path to the original image
+     * @param[out] image the mapped image
+     *
+     * @return true if the image was found
+    */
+    bool load(std::string filename, MappedImage &image) {
+        std::error_code error;
+        std::string path = std::filesystem::absolute(filename, error).string();
+        auto name = entry(path);
+
+        CacheHeader header;
+        std::string stored(path.size(), '\0');
+        std::ifstream file(name, std::ios::binary);
+        if (!file || !file.read((char *)&header, sizeof(header)) || !file.read(&stored[0], std::min<uint32_t>(header.pathLength, path.size())))
+            return false;
+        file.close();
+
+        CacheHeader current = expected(path);
+        if (header.magic != CACHE_MAGIC || header.version != CACHE_VERSION || header.pathLength != current.pathLength
+            || stored != path || header.fileSize != current.fileSize || header.fileTime != current.fileTime
+            || std::filesystem::file_size(name, error) != CACHE_ALIGNMENT + (uint64_t)header.width * header.height * 4) {
+            std::filesystem::remove(name, error);
+            return false;
+        }
+
+        std::filesystem::last_write_time(name, std::filesystem::file_time_type::clock::now(), error);
+        return image.map(name.string(), header.width, header.height);
+    }
+
+    /**
+     * puts the decoded image to the cache
+     *
+     * @param filename the path to the original image
+     * @param pixels RGBA pixels of the image
+     * @param width the width of the image in pixels
+     * @param height the height of the image in pixels
+     *
+     * @return true if the image was stored
+    */
+    bool store(std::string filename, const uint8_t *pixels, unsigned width, unsigned height) {
+        std::error_code error;
+        std::string path = std::filesystem::absolute(filename, error).string();
+        if (path.size() + sizeof(CacheHeader) > CACHE_ALIGNMENT)
+            return false;
+        auto name = entry(path);
+        // the temporary file is unique, so the concurrent writers of the same entry don't share it
+        std::random_device random;
+        std::stringstream suffix;
+        suffix << '.' << getpid() << '.' << std::hex << random() << ".tmp";
+        auto temporary = name;
+        temporary += suffix.str();
+
+        CacheHeader header = expected(path);
+        header.width = width;
+        header.height = height;
+        std::vector<char> head(CACHE_ALIGNMENT, 0);
+        memcpy(head.data(), &header, sizeof(header));
+        memcpy(head.data() + sizeof(header), path.data(), path.size());
+
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        file.write(head.data(), head.size());
+        file.write((const char *)pixels, (size_t)width * height * 4);
+        file.close();
+        if (!file) {
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+        std::filesystem::rename(temporary, name, error);
+        if (error)
+            return false;
+
+        evict(name);
+        return true;
+    }
+};
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <array>
 #include "math.hpp"
+#include "parallel.hpp"
 
 struct Lens {
     double mass;                    // mass of the lens in kg
@@ -19,6 +20,7 @@ protected:
     Lens lens;                      // lens in the system
     Source source;                  // source in the system
     float einstAngle;              // einstein angle of the system in radians
+    double delayDistance;           // time-delay distance of the system in meters
 
     /**
      * @return calculated einstein angle for the system in radians
@@ -30,6 +32,16 @@ protected:
         return std::sqrt(4 * G0 * lens.mass * D_ls / D_s / D_l / 3e19 * std::sqrt(2.5)) / c0;
     }
 
+    /**
+     * @return calculated time-delay distance (1 + z_l) D_l D_s / D_ls of the system in meters
+    */
+    double timeDelayDistance() {
+        double D_ls = angularDiameterDistanceBetween(lens.z, source.z);
+        double D_s = angularDiameterDistance(source.z);
+        double D_l = angularDiameterDistance(lens.z);
+        return (1 + lens.z) * D_l * D_s / D_ls * 3e19;
+    }
+
 public:
     /**
      * @param mass mass of the lensing object (gravitational lens) in kg
@@ -40,6 +52,7 @@ public:
     */
     LensSolver(double mass, float z1, float z2, double x=0, double y=0): lens{mass, z1, Point(x, y)}, source{z2} {
         einstAngle = einsteinAngle();
+        delayDistance = timeDelayDistance();
     }
     LensSolver(LensSolver&) = default;
 	LensSolver(LensSolver&&) = default;
@@ -116,6 +129,99 @@ public:
         return reverseProcessPoint(Point(x, y), magn);
     }
 
+    /**
+     * fermat potential of the point in the image plane for the source at the specified position
+     * 
+     * @param theta the point in the image plane in radians
+     * @param beta the source position in radians
+     * 
+     * @return fermat potential in square radians
+    */
+    double fermatPotential(Point theta, Point beta) {
+        auto dp = theta - beta;
+        auto dt = theta - lens.center;
+        return dp * dp / 2 - (double)einstAngle * einstAngle * std::log(dt.norm());
+    }
+
+    /**
+     * arrival time difference between the images of the source calculated by processPoint
+     * 
+     * @param p the source position in radians
+     * 
+     * @return delay of the second (inner) image relative to the first one in seconds
+    */
+    double timeDelay(Point p) {
+        float magn[2];
+        auto images = processPoint(p, magn);
+        return delayDistance / c0 * (fermatPotential(images[1], p) - fermatPotential(images[0], p));
+    }
+
+    /**
+     * @overload
+    */
+    double timeDelay(float x, float y) {
+        return timeDelay(Point(x, y));
+    }
+
+    /**
+     * time delays between the images for many source positions at once. uses the closed form for the point lens
+     * 
+     * @param[in] x horizontal coordinates of the sources in radians
+     * @param[in] y vertical coordinates of the sources in radians
+     * @param[in] n number of sources
+     * @param[out] delays array where n delays in seconds will be set (the same as timeDelay returns)
+    */
+    void timeDelays(const double *x, const double *y, size_t n, double *delays) {
+        const double cx = lens.center.x, cy = lens.center.y;
+        const double e = einstAngle;
+        const double k = delayDistance / c0 * e * e;
+        parallelFor(0, n, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++) {
+                double bx = (x[i] - cx) / e, by = (y[i] - cy) / e;
+                double u = std::sqrt(bx * bx + by * by);
+                double s = std::sqrt(u * u + 4);
+                delays[i] = k * (u * s / 2 + std::log((s + u) / (s - u)));
+            }
+        });
+    }
+
+    /**
+     * calculates the time-delay surface (arrival time of the light from the source) over the image plane.
+     * the pixel (i, j) corresponds to the point (x0 + i * scale, y0 + j * scale)
+     * 
+     * @param[in] beta the source position in radians
+     * @param[in] x0 horizontal coordinate of the first pixel in radians
+     * @param[in] y0 vertical coordinate of the first pixel in radians
+     * @param[in] scale size of the pixel in radians
+     * @param[in] width the width of the map in pixels
+     * @param[in] height the height of the map in pixels
+     * @param[out] map array of width * height values where the arrival times in seconds will be set
+    */
+    void timeDelayMap(Point beta, double x0, double y0, double scale, unsigned width, unsigned height, float *map) {
+        const double bx = beta.x, by = beta.y, cx = lens.center.x, cy = lens.center.y;
+        const double e2 = (double)einstAngle * einstAngle;
+        const double k = delayDistance / c0;
+        parallelFor(0, height, [&](size_t first, size_t last) {
+            for (size_t j = first; j < last; j++) {
+                const double ty = y0 + j * scale;
+                float *row = map + j * width;
+                for (unsigned i = 0; i < width; i++) {
+                    const double tx = x0 + i * scale;
+                    const double px = tx - bx, py = ty - by;
+                    const double lx = tx - cx, ly = ty - cy;
+                    row[i] = k * ((px * px + py * py) / 2 - e2 / 2 * std::log(lx * lx + ly * ly));
+                }
+            }
+        });
+    }
+
+    /**
+     * @return time-delay distance of the system in meters
+    */
+    double getTimeDelayDistance() {
+        return delayDistance;
+    }
+
     /**
      * moves the lens
      * 
@@ -0,0 +1,179 @@
+"""
+Thin python binding of the lensing library (liblensing, see lensingapi.h).
+
+Image buffers are numpy arrays (or any object supporting DLPack) that are passed
+to the library in place. Arrays of a wrong type or layout are rejected instead of
+being copied silently.
+"""
+import ctypes
+import sys
+from pathlib import Path
+
+import numpy as np
+
+_LIBRARY_NAME = {'darwin': 'liblensing.dylib', 'win32': 'lensing.dll'}.get(sys.platform, 'liblensing.so')
+_API_VERSION = 2
+
+_c_double_p = ctypes.POINTER(ctypes.c_double)
+_c_float_p = ctypes.POINTER(ctypes.c_float)
+_c_uint8_p = ctypes.POINTER(ctypes.c_uint8)
+
+
+def _load(path=None):
+    lib = ctypes.CDLL(str(path or Path(__file__).with_name(_LIBRARY_NAME)))
+    lib.lensing_api_version.restype = ctypes.c_int
+    if lib.lensing_api_version() != _API_VERSION:
+        raise RuntimeError('Unsupported lensing library version.')
+
+    lib.lensing_solver_new.restype = ctypes.c_void_p
+    lib.lensing_solver_new.argtypes = [ctypes.c_double, ctypes.c_float, ctypes.c_float, ctypes.c_double, ctypes.c_double]
+    lib.lensing_solver_free.argtypes = [ctypes.c_void_p]
+    lib.lensing_solver_set_lens_center.argtypes = [ctypes.c_void_p, ctypes.c_double, ctypes.c_double]
+    lib.lensing_solver_move_lens.argtypes = [ctypes.c_void_p, ctypes.c_double, ctypes.c_double]
+    lib.lensing_solver_update_mass.argtypes = [ctypes.c_void_p, ctypes.c_float]
+    lib.lensing_solver_get_lens_center.argtypes = [ctypes.c_void_p, _c_double_p, _c_double_p]
+    for name in ('get_mass', 'get_einstein_angle', 'get_time_delay_distance'):
+        getattr(lib, 'lensing_solver_' + name).restype = ctypes.c_double
+        getattr(lib, 'lensing_solver_' + name).argtypes = [ctypes.c_void_p]
+    lib.lensing_process_point.argtypes = [ctypes.c_void_p, ctypes.c_double, ctypes.c_double, _c_double_p, _c_float_p]
+    lib.lensing_reverse_process_point.argtypes = [ctypes.c_void_p, ctypes.c_double, ctypes.c_double, _c_double_p, _c_float_p]
+    lib.lensing_time_delays.argtypes = [ctypes.c_void_p, _c_double_p, _c_double_p, ctypes.c_size_t, _c_double_p]
+    lib.lensing_time_delay_map.argtypes = [ctypes.c_void_p, ctypes.c_double, ctypes.c_double, ctypes.c_double,
+                                           ctypes.c_double, ctypes.c_double, ctypes.c_uint, ctypes.c_uint, _c_float_p]
+    lib.lensing_render.argtypes = [ctypes.c_void_p, _c_uint8_p, ctypes.c_uint, ctypes.c_uint, _c_uint8_p,
+                                   ctypes.c_uint, ctypes.c_uint, ctypes.c_double, ctypes.c_int, ctypes.c_int, ctypes.c_int]
+    for name in ('solver_set_lens_center', 'solver_move_lens', 'solver_update_mass', 'solver_get_lens_center',
+                 'process_point', 'reverse_process_point', 'time_delays', 'time_delay_map', 'render'):
+        getattr(lib, 'lensing_' + name).restype = ctypes.c_int
+    return lib
+
+
+_lib = None
+
+
+def library():
+    """@return the loaded library (it is loaded on the first call)"""
+    global _lib
+    if _lib is None:
+        _lib = _load()
+    return _lib
+
+
+def _array(obj, dtype, writable=False):
+    """returns the numpy view of the buffer without copying it"""
+    if not isinstance(obj, np.ndarray) and hasattr(obj, '__dlpack__'):
+        obj = np.from_dlpack(obj)
+    arr = np.asarray(obj)
+    if arr.dtype != dtype:
+        raise TypeError('Expected %s buffer, got %s.' % (np.dtype(dtype), arr.dtype))
+    if not arr.flags.c_contiguous:
+        raise ValueError('Buffer must be C-contiguous.')
+    if writable and not arr.flags.writeable:
+        raise ValueError('Buffer must be writable.')
+    return arr
+
+
+def _check(code):
+    if code != 0:
+        raise RuntimeError('lensing library error %d' % code)
+
+
+class LensSolver:
+    """wrapper of the LensSolver object, coordinates are in radians and masses in kg"""
+
+    def __init__(self, mass, lens_z, source_z, x=0.0, y=0.0):
+        self._lib = library()
+        self._handle = self._lib.lensing_solver_new(mass, lens_z, source_z, x, y)
+        if not self._handle:
+            raise MemoryError('Failed to create the solver.')
+
+    def __del__(self):
+        if getattr(self, '_handle', None):
+            self._lib.lensing_solver_free(self._handle)
+            self._handle = None
+
+    @property
+    def mass(self):
+        return self._lib.lensing_solver_get_mass(self._handle)
+
+    @property
+    def einstein_angle(self):
+        return self._lib.lensing_solver_get_einstein_angle(self._handle)
+
+    @property
+    def time_delay_distance(self):
+        return self._lib.lensing_solver_get_time_delay_distance(self._handle)
+
+    @property
+    def lens_center(self):
+        x, y = ctypes.c_double(), ctypes.c_double()
+        _check(self._lib.lensing_solver_get_lens_center(self._handle, ctypes.byref(x), ctypes.byref(y)))
+        return x.value, y.value
+
+    @lens_center.setter
+    def lens_center(self, center):
+        _check(self._lib.lensing_solver_set_lens_center(self._handle, center[0], center[1]))
+
+    def move_lens(self, dx, dy):
+        _check(self._lib.lensing_solver_move_lens(self._handle, dx, dy))
+
+    def update_mass(self, k):
+        """newMass = 10^k * oldMass"""
+        _check(self._lib.lensing_solver_update_mass(self._handle, k))
+
+    def process_point(self, x, y):
+        """@return two image positions and their magnifications"""
+        images = (ctypes.c_double * 4)()
+        magn = (ctypes.c_float * 2)()
+        _check(self._lib.lensing_process_point(self._handle, x, y, images, magn))
+        return ((images[0], images[1]), (images[2], images[3])), (magn[0], magn[1])
+
+    def reverse_process_point(self, x, y):
+        """@return the original position of the point and the magnification"""
+        source = (ctypes.c_double * 2)()
+        magn = ctypes.c_float()
+        _check(self._lib.lensing_reverse_process_point(self._handle, x, y, source, ctypes.byref(magn)))
+        return (source[0], source[1]), magn.value
+
+    def time_delays(self, x, y, out=None):
+        """time delays in seconds between the images of the sources at (x, y), float64 arrays of the same size"""
+        x = _array(x, np.float64)
+        y = _array(y, np.float64)
+        if x.size != y.size:
+            raise ValueError('Coordinates arrays sizes differ.')
+        out = np.empty(x.shape, np.float64) if out is None else _array(out, np.float64, True)
+        if out.size != x.size:
+            raise ValueError('Output size differs from the input one.')
+        _check(self._lib.lensing_time_delays(self._handle, x.ctypes.data_as(_c_double_p), y.ctypes.data_as(_c_double_p),
+                                             x.size, out.ctypes.data_as(_c_double_p)))
+        return out
+
+    def time_delay_map(self, beta, x0, y0, scale, shape=None, out=None):
+        """arrival times in seconds over the grid of shape (height, width), float32"""
+        if out is None:
+            if shape is None:
+                raise ValueError('Either shape or out must be given.')
+            out = np.empty(shape, np.float32)
+        out = _array(out, np.float32, True)
+        if out.ndim != 2:
+            raise ValueError('Map must be two-dimensional.')
+        height, width = out.shape
+        _check(self._lib.lensing_time_delay_map(self._handle, beta[0], beta[1], x0, y0, scale, width, height,
+                                                out.ctypes.data_as(_c_float_p)))
+        return out
+
+    def render(self, source, scale, dx=0, dy=0, out=None, show_magnification=True):
+        """
+        renders the lensed image of source (uint8 array of shape (height, width, 4))
+        into out (the same layout, by default of the source size)
+        """
+        source = _array(source, np.uint8)
+        if source.ndim != 3 or source.shape[2] != 4:
+            raise ValueError('Source must have shape (height, width, 4).')
+        out = np.empty_like(source) if out is None else _array(out, np.uint8, True)
+        if out.ndim != 3 or out.shape[2] != 4:
+            raise ValueError('Output must have shape (height, width, 4).')
+        _check(self._lib.lensing_render(self._handle, source.ctypes.data_as(_c_uint8_p), source.shape[1], source.shape[0],
+                                        out.ctypes.data_as(_c_uint8_p), out.shape[1], out.shape[0], scale, dx, dy,
+                                        int(show_magnification)))
+        return out
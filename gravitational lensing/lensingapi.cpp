@@ -0,0 +1,144 @@
+// g++ -std=c++17 lensingapi.cpp -I/opt/local/include/ -L/opt/local/lib/ -O3 -fPIC -shared -pthread -fvisibility=hidden -lgsl -lcblas -o liblensing.so
+
+#include <new>
+#include <limits>
+#include "lensingapi.h"
+#include "lensSolver.hpp"
+#include "renderKernels.hpp"
+
+struct lensing_solver {
+    LensSolver solver;
+};
+
+/**
+ * calls the function and converts the escaped exception to the error code, so it never reaches the C caller
+*/
+template <typename F>
+static int guarded(F func) {
+    try {
+        return func();
+    }
+    catch (...) {
+        return LENSING_INTERNAL_ERROR;
+    }
+}
+
+static const double notANumber = std::numeric_limits<double>::quiet_NaN();
+
+int lensing_api_version(void) {
+    return LENSING_API_VERSION;
+}
+
+lensing_solver *lensing_solver_new(double mass, float lens_z, float source_z, double x, double y) {
+    try {
+        return new lensing_solver{LensSolver(mass, lens_z, source_z, x, y)};
+    }
+    catch (...) {
+        return nullptr;
+    }
+}
+
+void lensing_solver_free(lensing_solver *solver) {
+    delete solver;
+}
+
+int lensing_solver_set_lens_center(lensing_solver *solver, double x, double y) {
+    if (!solver)
+        return LENSING_NULL_POINTER;
+    solver->solver.setLensCenter(x, y);
+    return LENSING_OK;
+}
+
+int lensing_solver_move_lens(lensing_solver *solver, double dx, double dy) {
+    if (!solver)
+        return LENSING_NULL_POINTER;
+    solver->solver.moveLens(dx, dy);
+    return LENSING_OK;
+}
+
+int lensing_solver_update_mass(lensing_solver *solver, float k) {
+    if (!solver)
+        return LENSING_NULL_POINTER;
+    solver->solver.updateMass(k);
+    return LENSING_OK;
+}
+
+int lensing_solver_get_lens_center(lensing_solver *solver, double *x, double *y) {
+    if (!solver || !x || !y)
+        return LENSING_NULL_POINTER;
+    Point c = solver->solver.getLensCenter();
+    *x = c.x;
+    *y = c.y;
+    return LENSING_OK;
+}
+
+double lensing_solver_get_mass(lensing_solver *solver) {
+    return solver ? solver->solver.getMass() : notANumber;
+}
+
+double lensing_solver_get_einstein_angle(lensing_solver *solver) {
+    return solver ? solver->solver.getEinstainAngle() : notANumber;
+}
+
+double lensing_solver_get_time_delay_distance(lensing_solver *solver) {
+    return solver ? solver->solver.getTimeDelayDistance() : notANumber;
+}
+
+int lensing_process_point(lensing_solver *solver, double x, double y, double *images, float *magn) {
+    if (!solver || !images || !magn)
+        return LENSING_NULL_POINTER;
+    return guarded([&] {
+        auto p = solver->solver.processPoint(x, y, magn);
+        for (int i = 0; i < 2; i++) {
+            images[2 * i] = p[i].x;
+            images[2 * i + 1] = p[i].y;
+        }
+        return LENSING_OK;
+    });
+}
+
+int lensing_reverse_process_point(lensing_solver *solver, double x, double y, double *source, float *magn) {
+    if (!solver || !source)
+        return LENSING_NULL_POINTER;
+    return guarded([&] {
+        float m;
+        Point p = solver->solver.reverseProcessPoint(x, y, m);
+        source[0] = p.x;
+        source[1] = p.y;
+        if (magn)
+            *magn = m;
+        return LENSING_OK;
+    });
+}
+
+int lensing_time_delays(lensing_solver *solver, const double *x, const double *y, size_t n, double *delays) {
+    if (!solver || (n && (!x || !y || !delays)))
+        return LENSING_NULL_POINTER;
+    return guarded([&] {
+        solver->solver.timeDelays(x, y, n, delays);
+        return LENSING_OK;
+    });
+}
+
+int lensing_time_delay_map(lensing_solver *solver, double beta_x, double beta_y, double x0, double y0,
+                           double scale, unsigned width, unsigned height, float *map) {
+    if (!solver || !map)
+        return LENSING_NULL_POINTER;
+    return guarded([&] {
+        solver->solver.timeDelayMap(Point(beta_x, beta_y), x0, y0, scale, width, height, map);
+        return LENSING_OK;
+    });
+}
+
+int lensing_render(lensing_solver *solver, const uint8_t *source, unsigned src_width, unsigned src_height,
+                   uint8_t *pixels, unsigned width, unsigned height, double scale, int dx, int dy,
+                   int show_magnification) {
+    if (!solver || !source || !pixels)
+        return LENSING_NULL_POINTER;
+    if (!src_width || !src_height || scale <= 0)
+        return LENSING_BAD_SIZE;
+    return guarded([&] {
+        reverseRender(&solver->solver, source, src_width, src_height, pixels, width, height, scale, dx, dy, show_magnification);
+        return LENSING_OK;
+    });
+}
@@ -0,0 +1,98 @@
+/*
+ * C interface of the lensing library. all image buffers are owned by the caller and are used in place,
+ * the library never copies or keeps them. images are row-major without padding.
+ *
+ * every function that can fail returns LENSING_OK on success or a negative error code, no C++ exception
+ * leaves the library. getters of the scalar values return NaN for the NULL solver.
+*/
+#ifndef LENSING_API_H
+#define LENSING_API_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#define LENSING_EXPORT __declspec(dllexport)
+#else
+#define LENSING_EXPORT __attribute__((visibility("default")))
+#endif
+
+#define LENSING_API_VERSION     2
+
+#define LENSING_OK              0
+#define LENSING_NULL_POINTER    -1
+#define LENSING_BAD_SIZE        -2
+#define LENSING_INTERNAL_ERROR  -3      /* unexpected failure inside the library (e.g. thread creation) */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct lensing_solver lensing_solver;
+
+/* @return version of the interface (LENSING_API_VERSION the library was built with) */
+LENSING_EXPORT int lensing_api_version(void);
+
+/*
+ * @param mass mass of the lens in kg
+ * @param lens_z redshift of the lens
+ * @param source_z redshift of the source
+ * @param x initial horizontal coordinate of the lens in radians
+ * @param y initial vertical coordinate of the lens in radians
+ *
+ * @return new solver (must be freed by lensing_solver_free) or NULL
+*/
+LENSING_EXPORT lensing_solver *lensing_solver_new(double mass, float lens_z, float source_z, double x, double y);
+LENSING_EXPORT void lensing_solver_free(lensing_solver *solver);
+
+LENSING_EXPORT int lensing_solver_set_lens_center(lensing_solver *solver, double x, double y);
+LENSING_EXPORT int lensing_solver_move_lens(lensing_solver *solver, double dx, double dy);
+LENSING_EXPORT int lensing_solver_update_mass(lensing_solver *solver, float k);
+LENSING_EXPORT int lensing_solver_get_lens_center(lensing_solver *solver, double *x, double *y);
+LENSING_EXPORT double lensing_solver_get_mass(lensing_solver *solver);
+LENSING_EXPORT double lensing_solver_get_einstein_angle(lensing_solver *solver);
+LENSING_EXPORT double lensing_solver_get_time_delay_distance(lensing_solver *solver);
+
+/*
+ * processes the point in straight way
+ *
+ * @param[out] images four coordinates of the two images in radians (x1, y1, x2, y2)
+ * @param[out] magn two magnifications of the images
+*/
+LENSING_EXPORT int lensing_process_point(lensing_solver *solver, double x, double y, double *images, float *magn);
+
+/*
+ * processes the point in reverse way
+ *
+ * @param[out] source two coordinates of the original point in radians
+ * @param[out] magn magnification at the point (may be NULL)
+*/
+LENSING_EXPORT int lensing_reverse_process_point(lensing_solver *solver, double x, double y, double *source, float *magn);
+
+/*
+ * @param[out] delays n time delays between the images in seconds (see LensSolver::timeDelays)
+*/
+LENSING_EXPORT int lensing_time_delays(lensing_solver *solver, const double *x, const double *y, size_t n, double *delays);
+
+/*
+ * @param[out] map width * height arrival times in seconds (see LensSolver::timeDelayMap)
+*/
+LENSING_EXPORT int lensing_time_delay_map(lensing_solver *solver, double beta_x, double beta_y, double x0, double y0,
+                                          double scale, unsigned width, unsigned height, float *map);
+
+/*
+ * renders the lensed image in reverse way (see reverseRender)
+ *
+ * @param source RGBA pixels of the source image
+ * @param pixels RGBA pixels of the output image
+ * @param show_magnification nonzero if the colors will be magnified
+*/
+LENSING_EXPORT int lensing_render(lensing_solver *solver, const uint8_t *source, unsigned src_width, unsigned src_height,
+                                  uint8_t *pixels, unsigned width, unsigned height, double scale, int dx, int dy,
+                                  int show_magnification);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,13 +1,101 @@
-// g++ -std=c++17 main.cpp -I/opt/local/include/ /opt/local/lib/libsfml-graphics.dylib /opt/local/lib/libsfml-audio.dylib  /opt/local/lib/libsfml-window.dylib /opt/local/lib/libsfml-system.dylib -Ofast -lgsl -lcblas -o main
+// g++ -std=c++17 main.cpp -I/opt/local/include/ /opt/local/lib/libsfml-graphics.dylib /opt/local/lib/libsfml-audio.dylib  /opt/local/lib/libsfml-window.dylib /opt/local/lib/libsfml-system.dylib -Ofast -pthread -lgsl -lcblas -o main
 
 #include <iostream>
 #include "lensSolver.hpp"
 #include "renderer.hpp"
+#include "replayRenderer.hpp"
+#include "sourceReconstructor.hpp"
+#include "tiledRenderer.hpp"
+
+/**
+ * reconstructs the unlensed source from the observed image. the lens is placed in the center of the image,
+ * the source grid has the same size and scale as the image
+ * 
+ * @param solver pointer to the LensSolver object
+ * @param observed the path to the observed (lensed) image
+ * @param output the path where the reconstructed source will be saved
+ * @param realWidth real width of the image in arcseconds
+ * @param lambda the regularization strength
+*/
+int reconstructSource(LensSolver *solver, std::string observed, std::string output, float realWidth, double lambda=0.1) {
+	sf::Image image;
+	if (!image.loadFromFile(observed))
+		throw std::runtime_error("Failed to open file.");
+	unsigned width = image.getSize().x, height = image.getSize().y;
+	double scale = realWidth * arcsecToRad / width;
+	solver->setLensCenter(width / 2 * scale, height / 2 * scale);
+
+	SourceReconstructor reconstructor(solver, width, height, scale, SourceGrid{0, 0, scale, width, height});
+	std::vector<sf::Uint8> pixels(4 * (size_t)width * height, 255);
+	std::vector<float> channel((size_t)width * height);
+	const sf::Uint8 *in = image.getPixelsPtr();
+	for (int c = 0; c < 3; c++) {
+		for (size_t k = 0; k < channel.size(); k++)
+			channel[k] = in[4 * k + c];
+		// the operator is built once and reused for all channels
+		std::vector<float> source = reconstructor.reconstruct(channel.data(), lambda);
+		for (size_t k = 0; k < source.size(); k++)
+			pixels[4 * k + c] = std::min(std::max(source[k], 0.0f), 255.0f);
+	}
+	std::cout << "unknowns: " << reconstructor.getUnknowns() << ", iterations: " << reconstructor.getIterations()
+			  << ", residual: " << reconstructor.getResidual() << std::endl;
+
+	sf::Image result;
+	result.create(width, height, pixels.data());
+	if (!result.saveToFile(output))
+		throw std::runtime_error("Failed to save file.");
+	return EXIT_SUCCESS;
+}
+
+/**
+ * renders the lensed image of the tiled source to the tiled file of the same size and scale.
+ * the lens is placed in the center of the image
+ * 
+ * @param solver pointer to the LensSolver object
+ * @param sourceFile the path to the tiled source (see convertTiled)
+ * @param output the path to the output tiled file
+ * @param realWidth real width of the source in arcseconds
+*/
+int renderTiled(LensSolver *solver, std::string sourceFile, std::string output, float realWidth) {
+	TileCache cache(sourceFile, tileCacheSize);
+	TiledHeader header = cache.getHeader();
+	double scale = realWidth * arcsecToRad / header.width;
+	solver->setLensCenter(header.width / 2 * scale, header.height / 2 * scale);
+
+	TiledRenderer renderer(solver, cache, scale, scale);
+	renderer.render(output, header.width, header.height, header.tileSize);
+	std::cout << "source tiles loaded: " << cache.getMisses() << std::endl;
+	return EXIT_SUCCESS;
+}
+
+// ./main --record session.txt records the input events, ./main --replay session.txt replays them without window,
+// ./main --reconstruct observed.png source.png [mass] reconstructs the unlensed source from the observed image,
+// ./main --tile image.ppm source.til converts the image to the tiled format without loading it to the memory,
+// ./main --render-tiled source.til output.til [mass] renders the tiled source tile by tile
+int main(int argc, char **argv) {
+	std::string mode = argc >= 3 ? argv[1] : "";
+	if (mode == "--replay")
+		return ReplayRenderer(argv[2]).replay(std::cout) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	if (mode == "--reconstruct" && (argc == 4 || argc == 5)) {
+		LensSolver solver(argc == 5 ? std::stod(argv[4]) : 5e33, 0.5, 1);
+		return reconstructSource(&solver, argv[2], argv[3], 900);
+	}
+
+	if (mode == "--tile" && argc == 4) {
+		convertTiled(argv[2], argv[3]);
+		return EXIT_SUCCESS;
+	}
+	if (mode == "--render-tiled" && (argc == 4 || argc == 5)) {
+		LensSolver solver(argc == 5 ? std::stod(argv[4]) : 5e33, 0.5, 1);
+		return renderTiled(&solver, argv[2], argv[3], 900);
+	}
 
-int main() {
 	std::string sourceFile = "resources/images/BubbleNebulaMini.jpeg";
     auto solver = new LensSolver(5e33, 0.5, 1);
 	Renderer renderer(solver, sourceFile, 900);
+	if (mode == "--record")
+		renderer.startRecording(argv[2]);
 	int code = renderer.poll();
 	delete solver;
 	return code;
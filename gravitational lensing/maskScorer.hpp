@@ -0,0 +1,287 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/**
+ * rectangular window of an image in pixels
+*/
+struct Region {
+    unsigned x, y;                  // top left corner of the region
+    unsigned width, height;         // size of the region
+};
+
+/**
+ * thresholded image stored as packed 64-bit words. each row starts at a word boundary,
+ * so a region of interest can be addressed without any bit shifting
+*/
+class BitMask {
+protected:
+    unsigned width, height;         // size of the mask in pixels
+    unsigned rowWords;              // number of 64-bit words in one row
+    std::vector<uint64_t> bits;     // packed pixels, bit i of the word is the pixel 64 * word + i
+
+public:
+    /**
+     * creates an empty mask
+     *
+     * @param width the width of the mask in pixels
+     * @param height the height of the mask in pixels
+    */
+    BitMask(unsigned width, unsigned height): width(width), height(height), rowWords((width + 63) / 64),
+                                              bits((size_t)rowWords * height, 0) {}
+
+    /**
+     * thresholds the image and resamples it to the specified size by the nearest pixel
+     *
+     * @param pixels pointer to the pixels data (rows without padding)
+     * @param srcWidth the width of the image in pixels
+     * @param srcHeight the height of the image in pixels
+     * @param width the width of the mask in pixels
+     * @param height the height of the mask in pixels
+     * @param channels number of bytes per pixel (1 for gray, 3 for RGB, 4 for RGBA)
+     * @param threshold the pixel is set if its brightness is greater than this value
+    */
+    static BitMask resampled(const uint8_t *pixels, unsigned srcWidth, unsigned srcHeight, unsigned width, unsigned height,
+                             unsigned channels=4, uint8_t threshold=127)
+    {
+        BitMask mask(width, height);
+        for (unsigned y = 0; y < height; y++) {
+            const uint8_t *row = pixels + (size_t)(y * srcHeight / height) * srcWidth * channels;
+            uint64_t *out = mask.row(y);
+            for (unsigned x = 0; x < width; x++) {
+                const uint8_t *p = row + (size_t)(x * srcWidth / width) * channels;
+                if (brightness(p, channels) > threshold)
+                    out[x / 64] |= uint64_t(1) << (x % 64);
+            }
+        }
+        return mask;
+    }
+
+    /**
+     * thresholds the image keeping its size
+     *
+     * @param pixels pointer to the pixels data (rows without padding)
+     * @param width the width of the image in pixels
+     * @param height the height of the image in pixels
+     * @param channels number of bytes per pixel (1 for gray, 3 for RGB, 4 for RGBA)
+     * @param threshold the pixel is set if its brightness is greater than this value
+    */
+    BitMask(const uint8_t *pixels, unsigned width, unsigned height, unsigned channels=4, uint8_t threshold=127):
+            BitMask(resampled(pixels, width, height, width, height, channels, threshold)) {}
+
+    /**
+     * @return the brightness of the pixel in the same way as the grayscale conversion in opencv does
+    */
+    static uint8_t brightness(const uint8_t *p, unsigned channels) {
+        if (channels < 3)
+            return p[0];
+        return (299 * p[0] + 587 * p[1] + 114 * p[2]) / 1000;
+    }
+
+    bool get(unsigned x, unsigned y) const {
+        return (bits[(size_t)y * rowWords + x / 64] >> (x % 64)) & 1;
+    }
+
+    void set(unsigned x, unsigned y, bool value) {
+        uint64_t &word = bits[(size_t)y * rowWords + x / 64];
+        uint64_t bit = uint64_t(1) << (x % 64);
+        word = value ? (word | bit) : (word & ~bit);
+    }
+
+    /**
+     * @return pointer to the first word of the row
+    */
+    const uint64_t *row(unsigned y) const {
+        return bits.data() + (size_t)y * rowWords;
+    }
+
+    uint64_t *row(unsigned y) {
+        return bits.data() + (size_t)y * rowWords;
+    }
+
+    /**
+     * @return number of set pixels
+    */
+    uint64_t count() const {
+        uint64_t n = 0;
+        for (auto word : bits)
+            n += __builtin_popcountll(word);
+        return n;
+    }
+
+    unsigned getWidth() const {
+        return width;
+    }
+
+    unsigned getHeight() const {
+        return height;
+    }
+
+    unsigned getRowWords() const {
+        return rowWords;
+    }
+
+    /**
+     * @return the region that covers the whole mask
+    */
+    Region full() const {
+        return Region{0, 0, width, height};
+    }
+};
+
+/**
+ * scores candidate masks against the observed one. the score is the number of mismatched pixels
+*/
+class MaskScorer {
+protected:
+    BitMask observed;               // observed (thresholded) image
+    uint64_t best;                  // the best score among submitted candidates
+
+    /**
+     * counts set bits in the first n words of (a xor b)
+    */
+    static uint64_t xorCount(const uint64_t *a, const uint64_t *b, unsigned n) {
+        uint64_t count = 0;
+        unsigned i = 0;
+#ifdef __AVX2__
+        // nibble lookup popcount, the bytes sums are accumulated by sad against zero
+        const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                                0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i low = _mm256_set1_epi8(0x0f);
+        __m256i acc = _mm256_setzero_si256();
+        for (; i + 4 <= n; i += 4) {
+            __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                         _mm256_loadu_si256((const __m256i *)(b + i)));
+            __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low));
+            __m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+            acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256()));
+        }
+        count += _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+                 _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+#endif
+        for (; i < n; i++)
+            count += __builtin_popcountll(a[i] ^ b[i]);
+        return count;
+    }
+
+public:
+    /**
+     * @param observed the mask the candidates will be compared with
+    */
+    MaskScorer(BitMask observed): observed(std::move(observed)), best(std::numeric_limits<uint64_t>::max()) {}
+
+    /**
+     * counts mismatched pixels inside the region. the counting is stopped as soon as the count exceeds the bound
+     *
+     * @param candidate the mask of the same size as the observed one
+     * @param roi region of interest where the pixels are compared
+     * @param bound the counting is stopped when the score becomes greater than this value
+     *
+     * @return number of mismatched pixels (or any number greater than bound if the counting was stopped)
+     *
+     * @throw std::invalid_argument is thrown if the sizes of masks differ
+    */
+    uint64_t score(const BitMask &candidate, Region roi, uint64_t bound=std::numeric_limits<uint64_t>::max()) const {
+        if (candidate.getWidth() != observed.getWidth() || candidate.getHeight() != observed.getHeight())
+            throw std::invalid_argument("Masks sizes differ.");
+
+        unsigned x1 = std::min(roi.x + roi.width, observed.getWidth());
+        unsigned y1 = std::min(roi.y + roi.height, observed.getHeight());
+        if (roi.x >= x1 || roi.y >= y1)
+            return 0;
+
+        unsigned first = roi.x / 64;
+        unsigned last = (x1 - 1) / 64;
+        uint64_t headMask = ~uint64_t(0) << (roi.x % 64);
+        uint64_t tailMask = ~uint64_t(0) >> (63 - (x1 - 1) % 64);
+
+        uint64_t count = 0;
+        for (unsigned y = roi.y; y < y1; y++) {
+            const uint64_t *a = observed.row(y);
+            const uint64_t *b = candidate.row(y);
+            if (first == last)
+                count += __builtin_popcountll((a[first] ^ b[first]) & headMask & tailMask);
+            else {
+                count += __builtin_popcountll((a[first] ^ b[first]) & headMask);
+                count += xorCount(a + first + 1, b + first + 1, last - first - 1);
+                count += __builtin_popcountll((a[last] ^ b[last]) & tailMask);
+            }
+            if (count > bound)
+                return count;
+        }
+        return count;
+    }
+
+    /**
+     * counts mismatched pixels over the whole mask
+     *
+     * @overload
+    */
+    uint64_t score(const BitMask &candidate) const {
+        return score(candidate, observed.full());
+    }
+
+    /**
+     * scores the candidate with early exit against the best score so far and remembers it if it is better
+     *
+     * @param candidate the mask of the same size as the observed one
+     * @param roi region of interest where the pixels are compared
+     * @param[out] result the score of the candidate (or any number greater than the best one if counting was stopped)
+     *
+     * @return true if the candidate is the best one so far
+    */
+    bool submit(const BitMask &candidate, Region roi, uint64_t &result) {
+        result = score(candidate, roi, best);
+        if (result >= best)
+            return false;
+        best = result;
+        return true;
+    }
+
+    /**
+     * @overload
+    */
+    bool submit(const BitMask &candidate, uint64_t &result) {
+        return submit(candidate, observed.full(), result);
+    }
+
+    /**
+     * forgets the best score so far
+    */
+    void reset() {
+        best = std::numeric_limits<uint64_t>::max();
+    }
+
+    /**
+     * @return the best score among submitted candidates
+    */
+    uint64_t getBest() const {
+        return best;
+    }
+
+    /**
+     * @return the observed mask
+    */
+    const BitMask &getObserved() const {
+        return observed;
+    }
+
+    /**
+     * converts the score to the match percent in the same way as analyzeImages.py does
+     *
+     * @param score number of mismatched pixels
+     * @param roi the region where the score was calculated
+     *
+     * @return percent of matched pixels
+    */
+    static float matchPercent(uint64_t score, Region roi) {
+        return 100 - 100.0 * score / ((double)roi.width * roi.height);
+    }
+};
@@ -0,0 +1,273 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+#include "lensSolver.hpp"
+#include "maskScorer.hpp"
+#include "parallel.hpp"
+
+/**
+ * uniform disc in the source plane (the same source as createSource draws in fitModel.cpp)
+*/
+struct DiscSource {
+    double x, y;                    // center of the disc in source pixels
+    double radius;                  // radius of the disc in source pixels
+};
+
+/**
+ * result of the mass estimation
+*/
+struct MassEstimate {
+    double best;                    // the best fit mass for the observed mask in kg
+    double median;                  // median of the realizations in kg
+    double lower, upper;            // bounds of the confidence interval in kg
+    double mean, deviation;         // mean and standard deviation of the realizations in kg
+    std::vector<double> samples;    // the best fit masses of all realizations in kg
+};
+
+/**
+ * estimates the uncertainty of the fitted lens mass. the mass fit is repeated for many realizations of the observed
+ * mask (bootstrap or noise perturbed ones) in parallel. model masks for all masses of the grid are rendered once
+ * from the precomputed lens map and are shared between the realizations
+*/
+class MassUncertainty {
+protected:
+    LensSolver *solver = nullptr;   // pointer to the LensSolver object (its lens center and redshifts are used)
+    BitMask observed;               // the observed mask
+    double scale;                   // scale param (ratio of real size to the number of pixels in mask)
+    int dx, dy;                     // shift of the source in pixels (the same as in Renderer)
+    DiscSource source;              // the source model
+    std::vector<double> masses;     // the grid of masses in kg
+    std::vector<BitMask> models;    // model masks for every mass of the grid
+    bool showMagnification;         // flag shows if the magnification dims the images as in Renderer
+
+    /**
+     * renders the model masks for all masses. the lens map (offset from the lens center and the deflection
+     * direction of every pixel) doesn't depend on the mass, so it is calculated only once
+    */
+    void build() {
+        unsigned width = observed.getWidth(), height = observed.getHeight();
+        size_t n = (size_t)width * height;
+        Point c = solver->getLensCenter();
+        std::vector<double> tx(n), ty(n), ux(n), uy(n), t2(n);
+        parallelFor(0, n, [&](size_t first, size_t last) {
+            for (size_t k = first; k < last; k++) {
+                tx[k] = (int)(k % width + dx) * scale - c.x;
+                ty[k] = (int)(k / width + dy) * scale - c.y;
+                t2[k] = tx[k] * tx[k] + ty[k] * ty[k];
+                ux[k] = tx[k] / t2[k];
+                uy[k] = ty[k] / t2[k];
+            }
+        });
+
+        double e0 = solver->getEinstainAngle();
+        double m0 = solver->getMass();
+        models.assign(masses.size(), BitMask(width, height));
+        parallelFor(0, masses.size(), [&](size_t first, size_t last) {
+            for (size_t m = first; m < last; m++) {
+                double e2 = e0 * e0 * masses[m] / m0;
+                for (unsigned y = 0; y < height; y++) {
+                    uint64_t *row = models[m].row(y);
+                    for (unsigned x = 0; x < width; x++) {
+                        size_t k = (size_t)y * width + x;
+                        double px = (tx[k] - e2 * ux[k] + c.x) / scale;
+                        double py = (ty[k] - e2 * uy[k] + c.y) / scale;
+                        if (!(px >= 1 && py >= 1))
+                            continue;
+                        double sx = std::floor(px) + 0.5 - source.x, sy = std::floor(py) + 0.5 - source.y;
+                        if (sx * sx + sy * sy >= source.radius * source.radius)
+                            continue;
+                        // white color is magnified as in Renderer and then thresholded at 127
+                        double magn = std::abs(1 / (1 - e2 * e2 / (t2[k] * t2[k])));
+                        if (showMagnification && 255 * std::min(std::max(magn, 0.25), 2.0) <= 127)
+                            continue;
+                        row[x / 64] |= uint64_t(1) << (x % 64);
+                    }
+                }
+            }
+        });
+    }
+
+    /**
+     * @return the best fit mass for the scores. the mass of the grid is returned without refinement: the scores
+     * are V-shaped and not symmetric around the minimum, so the interpolation biases the mass even without noise
+    */
+    double bestMass(const std::vector<uint64_t> &scores) {
+        return masses[std::min_element(scores.begin(), scores.end()) - scores.begin()];
+    }
+
+    /**
+     * @param mass the mass in kg
+     * @param side -1 for the lower edge, 1 for the upper edge
+     *
+     * @return the edge of the grid cell (the masses closer to its grid mass than to the neighbouring ones) of the mass
+    */
+    double cellEdge(double mass, int side) {
+        size_t j = std::lower_bound(masses.begin(), masses.end(), mass) - masses.begin();
+        if (j == masses.size() || (j > 0 && mass - masses[j - 1] < masses[j] - mass))
+            j--;
+        size_t k = side < 0 ? (j > 0 ? j - 1 : j) : std::min(j + 1, masses.size() - 1);
+        return (masses[j] + masses[k]) / 2;
+    }
+
+    /**
+     * calculates the statistics of the realizations. the bounds of the interval are extended to the edges
+     * of the grid cells, since the best fit masses are known only up to the step of the grid
+    */
+    MassEstimate estimate(std::vector<double> samples, double confidence) {
+        MassEstimate result;
+        result.best = bestMass(scores());
+        result.samples = samples;
+        std::sort(samples.begin(), samples.end());
+        auto quantile = [&](double q) {
+            double pos = q * (samples.size() - 1);
+            size_t i = std::min((size_t)pos, samples.size() - 1);
+            size_t j = std::min(i + 1, samples.size() - 1);
+            return samples[i] + (pos - i) * (samples[j] - samples[i]);
+        };
+        result.median = quantile(0.5);
+        result.lower = cellEdge(quantile((1 - confidence) / 2), -1);
+        result.upper = cellEdge(quantile((1 + confidence) / 2), 1);
+
+        double sum = 0, sum2 = 0;
+        for (double s : samples) {
+            sum += s;
+            sum2 += s * s;
+        }
+        result.mean = sum / samples.size();
+        result.deviation = std::sqrt(std::max(sum2 / samples.size() - result.mean * result.mean, 0.0));
+        return result;
+    }
+
+public:
+    /**
+     * @param solver pointer to the LensSolver object, its mass is used only as the reference for einstein angle
+     * @param observed the observed mask
+     * @param scale ratio of real size to the number of pixels in rad/pix
+     * @param dx horizontal shift of the source in pixels
+     * @param dy vertical shift of the source in pixels
+     * @param source the source model
+     * @param masses the grid of masses in kg (sorted)
+     * @param showMagnification if true the images are dimmed by the magnification as in Renderer
+     *
+     * @throw std::invalid_argument is thrown if the grid of masses is empty
+    */
+    MassUncertainty(LensSolver *solver, BitMask observed, double scale, int dx, int dy, DiscSource source,
+                    std::vector<double> masses, bool showMagnification=true):
+                    solver(solver), observed(std::move(observed)), scale(scale), dx(dx), dy(dy), source(source),
+                    masses(std::move(masses)), showMagnification(showMagnification)
+    {
+        if (this->masses.empty())
+            throw std::invalid_argument("Empty grid of masses.");
+        build();
+    }
+
+    /**
+     * @return scores (number of mismatched pixels) of the observed mask for every mass of the grid
+    */
+    std::vector<uint64_t> scores() {
+        MaskScorer scorer(observed);
+        std::vector<uint64_t> result(masses.size());
+        for (size_t m = 0; m < masses.size(); m++)
+            result[m] = scorer.score(models[m]);
+        return result;
+    }
+
+    /**
+     * bootstrap estimation. the rows of 64 pixels are resampled with replacement, the mass is fitted for every sample
+     *
+     * @param realizations number of bootstrap samples
+     * @param confidence the confidence level of the interval
+     * @param seed seed of the random generator (the result doesn't depend on the number of threads)
+    */
+    MassEstimate bootstrap(unsigned realizations, double confidence=0.68, uint64_t seed=1) {
+        size_t words = (size_t)observed.getRowWords() * observed.getHeight();
+
+        // mismatch counts of every word, only words mismatched for some mass affect the scores
+        std::vector<int32_t> active(words, -1);
+        std::vector<uint8_t> counts;
+        size_t activeWords = 0;
+        for (size_t w = 0; w < words; w++) {
+            const uint64_t *a = observed.row(0) + w;
+            bool mismatched = false;
+            for (auto &model : models)
+                mismatched |= (*a ^ model.row(0)[w]) != 0;
+            if (mismatched)
+                active[w] = activeWords++;
+        }
+        counts.resize(activeWords * masses.size());
+        for (size_t w = 0; w < words; w++)
+            if (active[w] >= 0)
+                for (size_t m = 0; m < masses.size(); m++)
+                    counts[active[w] * masses.size() + m] = __builtin_popcountll(observed.row(0)[w] ^ models[m].row(0)[w]);
+
+        std::vector<double> samples(realizations);
+        parallelFor(0, realizations, [&](size_t first, size_t last) {
+            std::vector<uint64_t> scores(masses.size());
+            for (size_t r = first; r < last; r++) {
+                std::mt19937_64 rng(seed + r);
+                std::uniform_int_distribution<size_t> draw(0, words - 1);
+                std::fill(scores.begin(), scores.end(), 0);
+                for (size_t i = 0; i < words; i++) {
+                    int32_t w = active[draw(rng)];
+                    if (w < 0)
+                        continue;
+                    const uint8_t *c = counts.data() + (size_t)w * masses.size();
+                    for (size_t m = 0; m < masses.size(); m++)
+                        scores[m] += c[m];
+                }
+                samples[r] = bestMass(scores);
+            }
+        });
+        return estimate(samples, confidence);
+    }
+
+    /**
+     * noise estimation. every pixel of the observed mask is flipped with the specified probability,
+     * the mass is fitted for every perturbed mask
+     *
+     * @param realizations number of perturbed masks
+     * @param flipProbability probability of the pixel to be flipped
+     * @param confidence the confidence level of the interval
+     * @param seed seed of the random generator (the result doesn't depend on the number of threads)
+    */
+    MassEstimate perturb(unsigned realizations, double flipProbability, double confidence=0.68, uint64_t seed=1) {
+        unsigned width = observed.getWidth(), height = observed.getHeight();
+        size_t n = (size_t)width * height;
+
+        std::vector<double> samples(realizations);
+        parallelFor(0, realizations, [&](size_t first, size_t last) {
+            std::vector<uint64_t> scores(masses.size());
+            for (size_t r = first; r < last; r++) {
+                std::mt19937_64 rng(seed + r);
+                BitMask mask = observed;
+                if (flipProbability > 0) {
+                    // the gaps between the flipped pixels are geometrically distributed
+                    std::geometric_distribution<size_t> gap(std::min(flipProbability, 1.0));
+                    for (size_t k = gap(rng); k < n; k += gap(rng) + 1)
+                        mask.set(k % width, k / width, !mask.get(k % width, k / width));
+                }
+
+                // the scores are counted only until they exceed the best one, it doesn't change the minimum
+                MaskScorer scorer(std::move(mask));
+                uint64_t score;
+                for (size_t m = 0; m < masses.size(); m++) {
+                    scorer.submit(models[m], score);
+                    scores[m] = score;
+                }
+                samples[r] = bestMass(scores);
+            }
+        });
+        return estimate(samples, confidence);
+    }
+
+    /**
+     * @return the grid of masses in kg
+    */
+    const std::vector<double> &getMasses() {
+        return masses;
+    }
+};
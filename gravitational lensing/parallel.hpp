@@ -0,0 +1,95 @@
+#pragma once
+
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <exception>
+
+/**
+ * @return number of threads used by the parallel helpers
+*/
+inline unsigned threadsNumber() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/**
+ * splits the range to contiguous chunks and processes each of them in a separate thread
+ *
+ * @param begin the first index of the range
+ * @param end the index after the last one
+ * @param func function called as func(chunkBegin, chunkEnd)
+ * @param threads number of threads (0 means all available cores)
+ *
+ * @throw the first exception thrown by func is rethrown after all chunks are finished
+*/
+template <typename F>
+void parallelFor(size_t begin, size_t end, F func, unsigned threads=0) {
+    if (end <= begin)
+        return;
+    if (!threads)
+        threads = threadsNumber();
+    size_t n = end - begin;
+    threads = (unsigned)std::min<size_t>(threads, n);
+    if (threads <= 1) {
+        func(begin, end);
+        return;
+    }
+
+    // the exception thrown in the thread would terminate the program, so the first one is kept
+    // and rethrown after all threads are joined
+    std::exception_ptr error;
+    std::mutex lock;
+    auto run = [&](size_t first, size_t last) {
+        try {
+            func(first, last);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> guard(lock);
+            if (!error)
+                error = std::current_exception();
+        }
+    };
+
+    size_t chunk = (n + threads - 1) / threads;
+    std::vector<std::thread> pool;
+    for (size_t first = begin + chunk; first < end; first += chunk)
+        pool.emplace_back(run, first, std::min(first + chunk, end));
+    run(begin, std::min(begin + chunk, end));
+    for (auto &t : pool)
+        t.join();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+/**
+ * sums values calculated for contiguous chunks of the range in separate threads
+ *
+ * @param begin the first index of the range
+ * @param end the index after the last one
+ * @param func function called as func(chunkBegin, chunkEnd) that returns the partial sum
+ * @param threads number of threads (0 means all available cores)
+ *
+ * @return the sum of all partial sums
+*/
+template <typename T, typename F>
+T parallelSum(size_t begin, size_t end, F func, unsigned threads=0) {
+    if (end <= begin)
+        return T(0);
+    if (!threads)
+        threads = threadsNumber();
+    size_t n = end - begin;
+    threads = (unsigned)std::min<size_t>(threads, n);
+    size_t chunk = (n + threads - 1) / threads;
+
+    std::vector<T> partial((n + chunk - 1) / chunk, T(0));
+    parallelFor(0, partial.size(), [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++)
+            partial[i] = func(begin + i * chunk, std::min(begin + (i + 1) * chunk, end));
+    }, threads);
+
+    T sum(0);
+    for (auto &p : partial)
+        sum += p;
+    return sum;
+}
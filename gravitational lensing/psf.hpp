@@ -0,0 +1,465 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <complex>
+#include <random>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include "constants.hpp"
+#include "parallel.hpp"
+
+#define POISSON_NORMAL_LIMIT    100     // electrons above which the photon noise is drawn from the normal approximation
+
+/**
+ * point spread function. the kernel is square with odd size and is normalized to the unit sum
+*/
+class PSF {
+protected:
+    std::vector<float> kernel;      // size * size values of the kernel
+    std::vector<float> profile;     // one-dimensional profile if the kernel is separable (empty otherwise)
+    unsigned size;                  // size of the kernel in pixels
+
+    PSF(std::vector<float> kernel, unsigned size, std::vector<float> profile={}):
+        kernel(std::move(kernel)), profile(std::move(profile)), size(size)
+    {
+        double sum = 0;
+        for (float v : this->kernel)
+            sum += v;
+        if (!(sum > 0))
+            throw std::invalid_argument("Kernel sum must be positive.");
+        for (float &v : this->kernel)
+            v /= sum;
+        double profileSum = 0;
+        for (float v : this->profile)
+            profileSum += v;
+        for (float &v : this->profile)
+            v /= profileSum;
+    }
+
+    /**
+     * @return radius of the kernel in pixels where the profile becomes negligible
+    */
+    static unsigned radius(double r) {
+        return std::max(1, (int)std::ceil(r));
+    }
+
+public:
+    /**
+     * @param fwhm full width at half maximum in arcseconds
+     * @param scale ratio of real size to the number of pixels in rad/pix
+    */
+    static PSF gaussian(double fwhm, double scale) {
+        double sigma = fwhm * arcsecToRad / scale / (2 * std::sqrt(2 * std::log(2)));
+        unsigned r = radius(3 * sigma);
+        std::vector<float> profile(2 * r + 1);
+        for (unsigned i = 0; i < profile.size(); i++)
+            profile[i] = std::exp(-std::pow((double)i - r, 2) / (2 * sigma * sigma));
+
+        std::vector<float> kernel(profile.size() * profile.size());
+        for (unsigned j = 0; j < profile.size(); j++)
+            for (unsigned i = 0; i < profile.size(); i++)
+                kernel[j * profile.size() + i] = profile[j] * profile[i];
+        return PSF(kernel, profile.size(), profile);
+    }
+
+    /**
+     * @param fwhm full width at half maximum in arcseconds
+     * @param beta power index of the profile
+     * @param scale ratio of real size to the number of pixels in rad/pix
+    */
+    static PSF moffat(double fwhm, double beta, double scale) {
+        double alpha = fwhm * arcsecToRad / scale / (2 * std::sqrt(std::pow(2, 1 / beta) - 1));
+        // the profile is cut where it drops to 1e-3 of the maximum
+        unsigned r = radius(alpha * std::sqrt(std::pow(1e3, 1 / beta) - 1));
+        unsigned n = 2 * r + 1;
+        std::vector<float> kernel(n * n);
+        for (unsigned j = 0; j < n; j++)
+            for (unsigned i = 0; i < n; i++) {
+                double r2 = std::pow((double)i - r, 2) + std::pow((double)j - r, 2);
+                kernel[j * n + i] = std::pow(1 + r2 / (alpha * alpha), -beta);
+            }
+        return PSF(kernel, n);
+    }
+
+    /**
+     * loads the kernel from the primary image of the FITS file. the data is centered in the square kernel
+     * of odd size (non-square and even kernels are padded with zeros)
+     *
+     * @param filename the path to the FITS file
+     *
+     * @throw std::runtime_error is thrown if the file couldn't be open or has unsupported format
+    */
+    static PSF fromFits(std::string filename) {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file)
+            throw std::runtime_error("Failed to open file.");
+
+        int bitpix = 0, naxis = 0;
+        long width = 0, height = 0;
+        double bscale = 1, bzero = 0;
+        char card[81] = {0};
+        bool end = false;
+        size_t cards = 0;
+        while (!end && file.read(card, 80)) {
+            cards++;
+            std::string key = std::string(card, 8);
+            key.erase(key.find_last_not_of(' ') + 1);
+            std::string value = card[8] == '=' ? std::string(card + 10, 70) : "";
+            if (key == "END")
+                end = true;
+            else if (key == "BITPIX")
+                bitpix = std::stoi(value);
+            else if (key == "NAXIS")
+                naxis = std::stoi(value);
+            else if (key == "NAXIS1")
+                width = std::stol(value);
+            else if (key == "NAXIS2")
+                height = std::stol(value);
+            else if (key == "BSCALE")
+                bscale = std::stod(value);
+            else if (key == "BZERO")
+                bzero = std::stod(value);
+        }
+        if (!end || naxis != 2 || width <= 0 || height <= 0)
+            throw std::runtime_error("Unsupported FITS kernel.");
+        file.seekg((cards + 35) / 36 * 2880);
+
+        int bytes = std::abs(bitpix) / 8;
+        std::vector<unsigned char> data((size_t)width * height * bytes);
+        if (!file.read((char *)data.data(), data.size()))
+            throw std::runtime_error("Failed to read FITS data.");
+
+        unsigned n = std::max(width, height) | 1;
+        long x0 = (n - width) / 2, y0 = (n - height) / 2;
+        std::vector<float> kernel(n * n, 0);
+        for (long j = 0; j < height; j++)
+            for (long i = 0; i < width; i++) {
+                const unsigned char *p = data.data() + (j * width + i) * bytes;
+                uint64_t raw = 0;
+                for (int b = 0; b < bytes; b++)            // FITS data is big-endian
+                    raw = raw << 8 | p[b];
+                double v;
+                if (bitpix == 8)
+                    v = (uint8_t)raw;
+                else if (bitpix == 16)
+                    v = (int16_t)raw;
+                else if (bitpix == 32)
+                    v = (int32_t)raw;
+                else if (bitpix == -32) {
+                    uint32_t r32 = raw;
+                    float f;
+                    memcpy(&f, &r32, 4);
+                    v = f;
+                }
+                else if (bitpix == -64)
+                    memcpy(&v, &raw, 8);
+                else
+                    throw std::runtime_error("Unsupported FITS kernel.");
+                kernel[(y0 + j) * n + x0 + i] = bzero + bscale * v;
+            }
+        return PSF(kernel, n);
+    }
+
+    const std::vector<float> &getKernel() const {
+        return kernel;
+    }
+
+    /**
+     * @return one-dimensional profile if the kernel is separable (empty otherwise)
+    */
+    const std::vector<float> &getProfile() const {
+        return profile;
+    }
+
+    unsigned getSize() const {
+        return size;
+    }
+};
+
+/**
+ * detector noise model
+*/
+struct NoiseModel {
+    double gain;                    // electrons per one unit of the pixel value
+    double readNoise;               // read noise in electrons
+    double sky;                     // sky background in pixel value units per square arcsecond
+};
+
+/**
+ * post-processing stage that convolves the rendered frame with the PSF and adds the detector noise.
+ * separable kernels are applied by two one-dimensional passes, small kernels directly,
+ * large ones through FFT. all passes are split over rows between threads
+*/
+class PSFStage {
+protected:
+    PSF psf;
+    double scale;                   // ratio of real size to the number of pixels in rad/pix
+    bool addNoise = false;          // flag shows if the noise will be added
+    NoiseModel noise;               // the noise model
+    uint64_t seed = 1;              // seed of the noise (it is changed every frame)
+    unsigned directLimit = 15;      // the maximum size of non-separable kernel applied directly
+    std::vector<float> planes[3];   // color channels of the frame
+    std::vector<float> buffer;      // intermediate results
+
+    std::vector<std::complex<float>> spectrum;  // spectrum of the kernel for the current padded size
+    unsigned spectrumWidth = 0, spectrumHeight = 0;
+    std::vector<std::complex<float>> rowTwiddles, columnTwiddles;   // roots of unity for the rows and the columns
+
+    /**
+     * horizontal then vertical pass of the separable kernel
+    */
+    void separable(std::vector<float> &plane, unsigned width, unsigned height) {
+        const std::vector<float> &k = psf.getProfile();
+        int r = k.size() / 2;
+        buffer.assign(plane.size(), 0);
+
+        parallelFor(0, height, [&](size_t first, size_t last) {
+            for (size_t y = first; y < last; y++) {
+                const float *in = plane.data() + y * width;
+                float *out = buffer.data() + y * width;
+                for (int j = -r; j <= r; j++) {
+                    const float w = k[j + r];
+                    int x0 = std::max(0, -j), x1 = std::min((int)width, (int)width - j);
+                    for (int x = x0; x < x1; x++)
+                        out[x] += w * in[x + j];
+                }
+            }
+        });
+
+        parallelFor(0, height, [&](size_t first, size_t last) {
+            for (size_t y = first; y < last; y++) {
+                float *out = plane.data() + y * width;
+                std::fill(out, out + width, 0.0f);
+                for (int j = -r; j <= r; j++) {
+                    long row = (long)y + j;
+                    if (row < 0 || row >= (long)height)
+                        continue;
+                    const float w = k[j + r];
+                    const float *in = buffer.data() + row * width;
+                    for (unsigned x = 0; x < width; x++)
+                        out[x] += w * in[x];
+                }
+            }
+        });
+    }
+
+    /**
+     * direct two-dimensional convolution
+    */
+    void direct(std::vector<float> &plane, unsigned width, unsigned height) {
+        const std::vector<float> &k = psf.getKernel();
+        int n = psf.getSize(), r = n / 2;
+        buffer.assign(plane.size(), 0);
+
+        parallelFor(0, height, [&](size_t first, size_t last) {
+            for (size_t y = first; y < last; y++) {
+                float *out = buffer.data() + y * width;
+                for (int j = -r; j <= r; j++) {
+                    long row = (long)y + j;
+                    if (row < 0 || row >= (long)height)
+                        continue;
+                    const float *in = plane.data() + row * width;
+                    for (int i = -r; i <= r; i++) {
+                        const float w = k[(r - j) * n + r - i];     // the kernel is flipped for convolution
+                        int x0 = std::max(0, -i), x1 = std::min((int)width, (int)width - i);
+                        for (int x = x0; x < x1; x++)
+                            out[x] += w * in[x + i];
+                    }
+                }
+            }
+        });
+        plane.swap(buffer);
+    }
+
+    /**
+     * @return n / 2 roots of unity exp(-2 pi i k / n) used by the forward FFT of n values
+    */
+    static std::vector<std::complex<float>> roots(size_t n) {
+        std::vector<std::complex<float>> twiddles(n / 2);
+        for (size_t k = 0; k < n / 2; k++)
+            twiddles[k] = std::polar(1.0, -2 * pi * k / n);
+        return twiddles;
+    }
+
+    /**
+     * in-place radix-2 FFT of n (power of two) values
+     *
+     * @param twiddles roots of unity of n (see roots), the inverse transform uses their conjugates
+    */
+    static void fft(std::complex<float> *a, size_t n, const std::vector<std::complex<float>> &twiddles, bool inverse) {
+        for (size_t i = 1, j = 0; i < n; i++) {
+            size_t bit = n >> 1;
+            for (; j & bit; bit >>= 1)
+                j ^= bit;
+            j ^= bit;
+            if (i < j)
+                std::swap(a[i], a[j]);
+        }
+        for (size_t len = 2; len <= n; len <<= 1) {
+            size_t step = n / len;
+            for (size_t i = 0; i < n; i += len)
+                for (size_t j = 0; j < len / 2; j++) {
+                    std::complex<float> t = inverse ? std::conj(twiddles[j * step]) : twiddles[j * step];
+                    std::complex<float> u = a[i + j], v = a[i + j + len / 2] * t;
+                    a[i + j] = u + v;
+                    a[i + j + len / 2] = u - v;
+                }
+        }
+    }
+
+    /**
+     * two-dimensional FFT, rows and columns are transformed in parallel
+    */
+    void fft2(std::vector<std::complex<float>> &a, unsigned width, unsigned height, bool inverse) {
+        parallelFor(0, height, [&](size_t first, size_t last) {
+            for (size_t y = first; y < last; y++)
+                fft(a.data() + y * width, width, rowTwiddles, inverse);
+        });
+        parallelFor(0, width, [&](size_t first, size_t last) {
+            std::vector<std::complex<float>> column(height);
+            for (size_t x = first; x < last; x++) {
+                for (size_t y = 0; y < height; y++)
+                    column[y] = a[y * width + x];
+                fft(column.data(), height, columnTwiddles, inverse);
+                for (size_t y = 0; y < height; y++)
+                    a[y * width + x] = column[y];
+            }
+        });
+    }
+
+    /**
+     * convolution through FFT. two real channels are packed into one complex image
+    */
+    void fourier(std::vector<float> &re, std::vector<float> *im, unsigned width, unsigned height) {
+        int n = psf.getSize(), r = n / 2;
+        unsigned w = 1, h = 1;
+        while (w < width + n - 1)
+            w *= 2;
+        while (h < height + n - 1)
+            h *= 2;
+
+        if (w != spectrumWidth || h != spectrumHeight) {
+            rowTwiddles = roots(w);
+            columnTwiddles = roots(h);
+            const std::vector<float> &k = psf.getKernel();
+            spectrum.assign((size_t)w * h, 0);
+            for (int j = -r; j <= r; j++)
+                for (int i = -r; i <= r; i++)
+                    spectrum[(size_t)((j + h) % h) * w + (i + w) % w] = k[(j + r) * n + i + r];
+            fft2(spectrum, w, h, false);
+            spectrumWidth = w;
+            spectrumHeight = h;
+        }
+
+        std::vector<std::complex<float>> a((size_t)w * h, 0);
+        for (size_t y = 0; y < height; y++)
+            for (size_t x = 0; x < width; x++)
+                a[y * w + x] = std::complex<float>(re[y * width + x], im ? (*im)[y * width + x] : 0);
+        fft2(a, w, h, false);
+        parallelFor(0, a.size(), [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++)
+                a[i] *= spectrum[i];
+        });
+        fft2(a, w, h, true);
+
+        float norm = 1.0f / ((float)w * h);
+        for (size_t y = 0; y < height; y++)
+            for (size_t x = 0; x < width; x++) {
+                re[y * width + x] = a[y * w + x].real() * norm;
+                if (im)
+                    (*im)[y * width + x] = a[y * w + x].imag() * norm;
+            }
+    }
+
+    /**
+     * adds the photon and the read noise to the channel
+    */
+    void applyNoise(std::vector<float> &plane, unsigned width, unsigned height, uint64_t frameSeed) {
+        double pixelArea = std::pow(scale / arcsecToRad, 2);
+        double sky = noise.sky * pixelArea;
+        parallelFor(0, height, [&](size_t first, size_t last) {
+            for (size_t y = first; y < last; y++) {
+                std::mt19937_64 rng(frameSeed + y);
+                std::normal_distribution<double> read(0, std::max(noise.readNoise, 1e-12)), unit(0, 1);
+                std::poisson_distribution<long> photons;
+                for (size_t x = 0; x < width; x++) {
+                    float &v = plane[y * width + x];
+                    double electrons = std::max(0.0, (v + sky) * noise.gain);
+                    // the poisson distribution of the large counts is close to the normal one, which is much cheaper
+                    double counts = electrons > POISSON_NORMAL_LIMIT ? std::round(electrons + std::sqrt(electrons) * unit(rng))
+                                  : electrons > 0 ? photons(rng, std::poisson_distribution<long>::param_type(electrons)) : 0;
+                    v = (counts + read(rng)) / noise.gain - sky;
+                }
+            }
+        });
+    }
+
+public:
+    /**
+     * @param psf the point spread function
+     * @param scale ratio of real size to the number of pixels in rad/pix (is used for the sky per pixel)
+    */
+    PSFStage(PSF psf, double scale): psf(std::move(psf)), scale(scale) {}
+
+    /**
+     * enables the detector noise
+     *
+     * @param model the noise model
+     * @param seed seed of the noise of the first frame
+    */
+    void setNoise(NoiseModel model, uint64_t seed=1) {
+        noise = model;
+        addNoise = model.gain > 0;
+        this->seed = seed;
+    }
+
+    /**
+     * @param limit the maximum size of non-separable kernel applied directly (larger kernels are applied through FFT)
+    */
+    void setDirectLimit(unsigned limit) {
+        directLimit = limit;
+    }
+
+    /**
+     * processes the frame in place. the alpha channel isn't changed
+     *
+     * @param pixels RGBA pixels of the frame
+     * @param width the width of the frame in pixels
+     * @param height the height of the frame in pixels
+    */
+    void apply(uint8_t *pixels, unsigned width, unsigned height) {
+        size_t n = (size_t)width * height;
+        for (int c = 0; c < 3; c++) {
+            planes[c].resize(n);
+            for (size_t i = 0; i < n; i++)
+                planes[c][i] = pixels[4 * i + c];
+        }
+
+        if (!psf.getProfile().empty())
+            for (int c = 0; c < 3; c++)
+                separable(planes[c], width, height);
+        else if (psf.getSize() <= directLimit)
+            for (int c = 0; c < 3; c++)
+                direct(planes[c], width, height);
+        else {
+            fourier(planes[0], &planes[1], width, height);
+            fourier(planes[2], nullptr, width, height);
+        }
+
+        if (addNoise) {
+            for (int c = 0; c < 3; c++)
+                applyNoise(planes[c], width, height, seed + (uint64_t)c * height);
+            seed += 3 * (uint64_t)height;
+        }
+
+        for (int c = 0; c < 3; c++)
+            for (size_t i = 0; i < n; i++)
+                pixels[4 * i + c] = std::min(255.0f, std::max(0.0f, std::round(planes[c][i])));
+    }
+};
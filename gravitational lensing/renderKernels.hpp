@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include "lensSolver.hpp"
+#include "parallel.hpp"
+
+/**
+ * processes an image in reverse way. for each pixel of the output is calculated where is the original point in the source.
+ * the output pixel (x, y) corresponds to the point ((x + dx) * scale, (y + dy) * scale)
+ *
+ * @param[in] solver pointer to the LensSolver object
+ * @param[in] source pointer to the RGBA pixels of the source image
+ * @param[in] srcWidth the width of the source image in pixels
+ * @param[in] srcHeight the height of the source image in pixels
+ * @param[out] pixels pointer to the RGBA pixels of the output image
+ * @param[in] width the width of the output image in pixels
+ * @param[in] height the height of the output image in pixels
+ * @param[in] scale ratio of real size to the number of pixels in rad/pix
+ * @param[in] dx horizontal shift of the output in pixels
+ * @param[in] dy vertical shift of the output in pixels
+ * @param[in] showMagnification flag shows if the colors will be magnified
+*/
+inline void reverseRender(LensSolver *solver, const uint8_t *source, unsigned srcWidth, unsigned srcHeight,
+                          uint8_t *pixels, unsigned width, unsigned height, double scale, int dx=0, int dy=0,
+                          bool showMagnification=true)
+{
+    parallelFor(0, height, [=](size_t first, size_t last) {
+        for (unsigned y = first; y < last; y++) {
+            uint8_t *out = pixels + 4 * (size_t)width * y;
+            for (unsigned x = 0; x < width; x++, out += 4) {
+                float m = 1.0;
+                Point p = solver->reverseProcessPoint((int)(x + dx) * scale, (int)(y + dy) * scale, m) / scale;
+                m = !showMagnification ? 1 : (m > 2) ? 2 : (m < 0.25) ? 0.25 : m;
+
+                // the same bounds as Renderer::checkPoint has for the truncated coordinates
+                if (!(p.x >= 1 && p.x < srcWidth && p.y >= 1 && p.y < srcHeight)) {
+                    out[0] = out[1] = out[2] = 0;
+                    out[3] = 255;
+                    continue;
+                }
+                const uint8_t *color = source + 4 * ((size_t)srcWidth * (unsigned)p.y + (unsigned)p.x);
+                for (int i = 0; i < 3; i++) {
+                    int colorComponent = color[i] * m;
+                    out[i] = colorComponent > 255 ? 255 : colorComponent;
+                }
+                out[3] = 255;
+            }
+        }
+    });
+}
@@ -4,7 +4,12 @@
 #include <string.h>
 #include <SFML/Graphics.hpp>
 #include "lensSolver.hpp"
+#include "renderKernels.hpp"
+#include "imageCache.hpp"
+#include "session.hpp"
+#include "psf.hpp"
 #include <sstream>
+#include <memory>
 #include <filesystem>
 
 namespace fs = std::filesystem;
@@ -18,8 +23,10 @@ std::string lastFile(std::string directory) {
 
 class Renderer {
 protected:
-    sf::RenderWindow window;			// the window where render is going
+    std::unique_ptr<sf::RenderWindow> window;	// the window where render is going (nullptr for the headless renderer)
     sf::Image source;					// source image that will be refracted
+	MappedImage mapped;					// the source image mapped from the image cache (unmapped if it wasn't cached)
+	const sf::Uint8 *sourcePixels = nullptr;	// RGBA pixels of the source (from the mapped or the decoded image)
     unsigned width, height;				// width and height of the window
     LensSolver *solver = nullptr;		// pointer the LensSolver object will be used in calculations
 	sf::Uint8 *pixels = nullptr;		// array with information about pixels color
@@ -27,6 +34,12 @@ protected:
 	bool showMagnification;				// flag shows if magnification will be shown
 	bool hideInfo; 						// flag shows if model info will be hidden
 	int dx, dy;
+	bool headless = false;				// flag shows if the renderer works without window
+	std::string sourceFile;				// the path to the source image (empty if the image was passed directly)
+	float realWidth = 0;				// real width of the source in arcseconds
+	SessionRecorder *recorder = nullptr;	// recorder of the input events (nullptr if the session isn't recorded)
+	sf::Clock sessionClock;				// time since the recording was started
+	PSFStage *postProcessing = nullptr;	// optional PSF convolution and noise stage applied to every frame
 
 	/**
 	 * checks if the point belongs to the window
@@ -51,7 +64,8 @@ protected:
     sf::Color getSourceColor(int x, int y) {
 		if (!checkPoint(x, y))
 			return sf::Color::Black;
-        return source.getPixel(x, y);
+		const sf::Uint8 *p = sourcePixels + 4 * ((size_t)y * width + x);
+        return sf::Color(p[0], p[1], p[2], p[3]);
 	}
 
 	/**
@@ -74,10 +88,22 @@ protected:
 
 	/**
 	 * Handles mouse events. Moves lens center to the mouse position.
+	 * 
+	 * @return the mouse position in window coordinates
+	*/
+    sf::Vector2f mouseHandle() {
+		sf::Vector2i posPixel = sf::Mouse::getPosition(*window);
+		sf::Vector2f pos = window->mapPixelToCoords(posPixel);
+		mouseHandle(pos);
+		return pos;
+	}
+
+	/**
+	 * Moves lens center to the position.
+	 * 
+	 * @param pos the position in window coordinates
 	*/
-    void mouseHandle() {
-		sf::Vector2i posPixel = sf::Mouse::getPosition(window);
-		sf::Vector2f pos = window.mapPixelToCoords(posPixel);
+	void mouseHandle(sf::Vector2f pos) {
 		solver->setLensCenter(pixToRad(pos.x), pixToRad(pos.y));
 	}
 
@@ -122,7 +148,7 @@ protected:
 			showMagnification = !showMagnification;
 		if (event.key.code == sf::Keyboard::H) 
 			hideInfo = !hideInfo;
-		if (event.key.code == sf::Keyboard::Enter)
+		if (event.key.code == sf::Keyboard::Enter && !headless)
 			saveImageInfo(saveImagesDirectory);
 	}
 
@@ -130,7 +156,7 @@ protected:
 		std::stringstream ss;
 		sf::Texture texture;
 		texture.create(width, height);
-		texture.update(window); 
+		texture.update(*window); 
     	sf::Image image = texture.copyToImage();
 		std::string filename = lastFile(directory);
 		int idx = filename.find("-");
@@ -145,7 +171,7 @@ protected:
 		std::stringstream ss;
 		sf::Texture texture;
 		texture.create(width, height);
-		texture.update(window); 
+		texture.update(*window); 
     	sf::Image image = texture.copyToImage();
 		auto p = solver->getLensCenter();
 		ss << directory << "lens_" << p.x << '_' << p.y
@@ -156,6 +182,47 @@ protected:
 		return image;
 	}
 
+	/**
+	 * loads the source image and sets the size of the window to its size. if the image is in the image cache,
+	 * it is rendered straight from the mapped entry without decoding and copying
+	 * 
+	 * @param filename the path to the file with image
+	 * 
+	 * @return true if the image was loaded
+	*/
+	bool loadSource(std::string filename) {
+		ImageCache cache(imageCacheDirectory, imageCacheSize);
+		if (cache.load(filename, mapped)) {
+			sourcePixels = mapped.pixels();
+			width = mapped.getWidth();
+			height = mapped.getHeight();
+			return true;
+		}
+		if (!source.loadFromFile(filename))
+			return false;
+		sourcePixels = source.getPixelsPtr();
+		width = source.getSize().x;
+		height = source.getSize().y;
+		cache.store(filename, sourcePixels, width, height);
+		return true;
+	}
+
+	/**
+	 * writes the event and the resulting state to the session file if the session is recorded
+	 * 
+	 * @param type 'k' for the key press, 'm' for the mouse drag
+	 * @param code the key code
+	 * @param pos the mouse position in window coordinates
+	 * @param latency time of the image recompute
+	*/
+	void recordEvent(char type, int code, sf::Vector2f pos, sf::Time latency) {
+		if (!recorder)
+			return;
+		Point c = solver->getLensCenter();
+		recorder->log(SessionEvent{type, sessionClock.getElapsedTime().asSeconds(), code, pos.x, pos.y,
+								   c.x, c.y, solver->getMass(), dx, dy, latency.asSeconds(), frameHash(pixels, width * height * 4)});
+	}
+
 	double pixToRad(int pix) {
 		return pix * scale;
 	}
@@ -176,35 +243,37 @@ public:
 																						height(source.getSize().y), width(source.getSize().x),
 																						scale(realWidth * 4.8481e-6 / source.getSize().x), dx(dx), dy(dy)
 	{
+		sourcePixels = this->source.getPixelsPtr();
 		if (radToPix(solver->getEinstainAngle()) > std::min(height, width)) 
 			std::cerr << "Warning! The lens too big for the image." << std::endl;
 
 		pixels = new sf::Uint8[width * height * 4];
-		window.create(sf::VideoMode(width, height), title);																							
+		window = std::make_unique<sf::RenderWindow>(sf::VideoMode(width, height), title);																							
 	}
 	/**
 	 * @param solver pointer to the LensSolver object
 	 * @param filename the path to the file with image for background (source)
 	 * @param realWidth real width of the object on image in arseconds
 	 * @param title the title of the window
+	 * @param headless if true the window isn't created (the image is only rendered to the pixels array)
 	 * 
 	 * @throw std::runtime_error is thrown if the 'filename' couldn't be open
 	*/
 
-    Renderer(LensSolver *solver, std::string filename, float realWidth, std::string title): solver(solver), showMagnification(true), dx(0), dy(0)
+    Renderer(LensSolver *solver, std::string filename, float realWidth, std::string title, bool headless=false): solver(solver), showMagnification(true), dx(0), dy(0),
+																						headless(headless), sourceFile(filename), realWidth(realWidth)
     {
-		if (!source.loadFromFile(filename))
+		if (!loadSource(filename))
     		throw std::runtime_error("Failed to open file.");
 
-		height = source.getSize().y;
-		width = source.getSize().x;
 		scale = realWidth * 4.8481e-6 / width;
 
 		if (radToPix(solver->getEinstainAngle()) > std::min(height, width)) 
 			std::cerr << "Warning! The lens too big for the image." << std::endl;
 
 		pixels = new sf::Uint8[width * height * 4];
-		window.create(sf::VideoMode(width, height), title);
+		if (!headless)
+			window = std::make_unique<sf::RenderWindow>(sf::VideoMode(width, height), title);
     }
 
 	/**
@@ -219,6 +288,24 @@ public:
 	*/
 	Renderer(LensSolver *solver, std::string filename): Renderer(solver, filename, 180, "Gravitational lens model") {}
 	
+	/**
+	 * starts recording of the input events. the current state of the model is written as the initial one,
+	 * so the recording should be started before any changes of the solver
+	 * 
+	 * @param filename the path to the session file
+	 * 
+	 * @throw std::runtime_error is thrown if the source wasn't loaded from file or the session file couldn't be open
+	*/
+	void startRecording(std::string filename) {
+		if (sourceFile.empty())
+			throw std::runtime_error("Only sessions with the source file can be recorded.");
+		Point c = solver->getLensCenter();
+		delete recorder;
+		recorder = new SessionRecorder(filename, SessionHeader{sourceFile, realWidth, solver->getMass(), solver->getLensRedshift(),
+															   solver->getSourceRedshift(), c.x, c.y, dx, dy, showMagnification});
+		sessionClock.restart();
+	}
+
 	/**
 	 * processes an image in straight way. each point in source splits to the calculated positions
 	*/
@@ -237,14 +324,25 @@ public:
 	 * processes an image in reverse way. for each point is calculated where is the original point in the source
 	*/
 	void reverseProcessImage() {
-		if (showMagnification)
-			for (unsigned y = 0; y < height; y++)
-				for (unsigned x = 0; x < width; x++) 
-					reverseProcessPoint(x + dx, y + dy);
-		else
-			for (unsigned y = 0; y < height; y++)
-				for (unsigned x = 0; x < width; x++) 
-					reverseProcessPointWithoutMagn(x + dx, y + dy);
+		reverseRender(solver, sourcePixels, width, height, pixels, width, height, scale, dx, dy, showMagnification);
+		if (postProcessing)
+			postProcessing->apply(pixels, width, height);
+	}
+
+	/**
+	 * sets the post-processing stage applied to every rendered frame
+	 * 
+	 * @param stage pointer to the PSFStage object (nullptr disables post-processing)
+	*/
+	void setPostProcessing(PSFStage *stage) {
+		postProcessing = stage;
+	}
+
+	/**
+	 * @return scale param (ratio of real size to the number of pixels in window) in rad/pix
+	*/
+	double getScale() {
+		return scale;
 	}
 
 	/**
@@ -327,7 +425,7 @@ public:
 
 		sf::Clock clock;
 		float currentTtime;
-		window.setFramerateLimit(FPS);
+		window->setFramerateLimit(FPS);
 
 		void (Renderer::*update)();
 		update = &Renderer::reverseProcessImage;
@@ -355,35 +453,39 @@ public:
 							    "lens redshift: " + lensZ.str() + '\n' + \
 							    "scale: " + scale_.str() + " rad/pix";
 
-		while (window.isOpen())
+		while (window->isOpen())
     	{
 			currentTtime = clock.restart().asSeconds();
 			sf::Event event;
 
-			while (window.pollEvent(event))
+			while (window->pollEvent(event))
 			{
 				if (event.type == sf::Event::Closed)
-					window.close();
+					window->close();
 				else if (event.type == sf::Event::KeyPressed)
 				{
 					keyboardHandle(event);
+					sf::Clock latency;
 					(*this.*update)();
+					recordEvent('k', event.key.code, sf::Vector2f(0, 0), latency.getElapsedTime());
 					mass.str("");
 					mass << solver->getMass();
 					einstAngle_.str("");
 					einstAngle_ << solver->getEinstainAngle();
 				}
                 else if (sf::Mouse::isButtonPressed(sf::Mouse::Left)){
-					mouseHandle();
+					sf::Vector2f pos = mouseHandle();
+					sf::Clock latency;
                     (*this.*update)();
+					recordEvent('m', 0, pos, latency.getElapsedTime());
 				}
 			}
 
-            window.clear();
+            window->clear();
 
 			texture.update(pixels);
             sprite.setTexture(texture);
-            window.draw(sprite);
+            window->draw(sprite);
 
 			precText.setString(modelInfo +  '\n' + \
 							   "lens mass: " + mass.str() + " kg" + '\n' + \
@@ -392,16 +494,18 @@ public:
 							    );
 			if (hideInfo) precText.setString("");
 			precText.setPosition(sf::Vector2f(10, 0));
-			window.draw(precText);	
+			window->draw(precText);	
             
-			window.display();
+			window->display();
     	}
 		return EXIT_SUCCESS;
 	}
 
     ~Renderer() {
-        window.close();
+		if (window)
+			window->close();
         delete [] pixels;
+		delete recorder;
     }
 };
 
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include "renderer.hpp"
+#include "session.hpp"
+
+/**
+ * replays the recorded session without window. the events are passed to the same handlers as in Renderer::poll,
+ * the recompute latency is measured and the frames and the states are compared with the recorded ones
+*/
+class ReplayRenderer: public Renderer {
+protected:
+    std::vector<SessionEvent> events;   // the recorded events
+    std::unique_ptr<LensSolver> owned;  // the solver created for the session
+
+    /**
+     * the solver is passed by the owning pointer, so it is deleted even if the Renderer constructor throws
+    */
+    ReplayRenderer(SessionHeader header, std::vector<SessionEvent> events, std::unique_ptr<LensSolver> owned):
+                   Renderer(owned.get(), header.sourceFile, header.realWidth, "", true),
+                   events(std::move(events)), owned(std::move(owned))
+    {
+        dx = header.dx;
+        dy = header.dy;
+        showMagnification = header.showMagnification;
+    }
+
+    /**
+     * @return true if the values differ more than the float precision allows
+    */
+    static bool differ(double a, double b) {
+        return std::abs(a - b) > 1e-6 * std::max(std::abs(a), std::abs(b));
+    }
+
+public:
+    /**
+     * @param filename the path to the session file
+     *
+     * @throw std::runtime_error is thrown if the session or its source image couldn't be open
+    */
+    ReplayRenderer(std::string filename): ReplayRenderer(readFile(filename)) {}
+
+    /**
+     * replays all events and prints the report
+     *
+     * @param out the stream where the report will be printed
+     *
+     * @return number of events after which the frame or the state differ from the recorded ones
+    */
+    int replay(std::ostream &out) {
+        std::vector<double> latencies;
+        int mismatches = 0, frameMismatches = 0, stateMismatches = 0;
+
+        for (size_t i = 0; i < events.size(); i++) {
+            const SessionEvent &e = events[i];
+            if (e.type == 'k') {
+                sf::Event event;
+                event.type = sf::Event::KeyPressed;
+                event.key.code = (sf::Keyboard::Key)e.code;
+                keyboardHandle(event);
+            }
+            else
+                mouseHandle(sf::Vector2f(e.x, e.y));
+
+            sf::Clock latency;
+            reverseProcessImage();
+            latencies.push_back(latency.getElapsedTime().asSeconds());
+
+            Point c = solver->getLensCenter();
+            bool state = differ(c.x, e.lensX) || differ(c.y, e.lensY) || differ(solver->getMass(), e.mass) || dx != e.dx || dy != e.dy;
+            bool frame = frameHash(pixels, width * height * 4) != e.frame;
+            stateMismatches += state;
+            frameMismatches += frame;
+            mismatches += state || frame;
+            if (state || frame)
+                out << "event " << i << " (" << e.type << "): " << (state ? "state " : "") << (frame ? "frame " : "") << "differs" << std::endl;
+        }
+
+        out << "events: " << events.size() << ", frame mismatches: " << frameMismatches
+            << ", state mismatches: " << stateMismatches << std::endl;
+        if (latencies.empty())
+            return mismatches;
+
+        double recorded = 0, total = 0;
+        for (size_t i = 0; i < events.size(); i++) {
+            recorded += events[i].latency;
+            total += latencies[i];
+        }
+        std::vector<double> sorted(latencies);
+        std::sort(sorted.begin(), sorted.end());
+        auto percentile = [&](double q) { return sorted[(size_t)(q * (sorted.size() - 1))] * 1e3; };
+        out << "recompute latency, ms: mean " << total / latencies.size() * 1e3
+            << " (recorded " << recorded / events.size() * 1e3 << ")"
+            << ", p50 " << percentile(0.5) << ", p95 " << percentile(0.95) << ", max " << sorted.back() * 1e3 << std::endl;
+
+        return mismatches;
+    }
+
+private:
+    struct Session {
+        SessionHeader header;
+        std::vector<SessionEvent> events;
+    };
+
+    static Session readFile(std::string filename) {
+        Session session;
+        readSession(filename, session.header, session.events);
+        return session;
+    }
+
+    ReplayRenderer(Session session): ReplayRenderer(session.header, std::move(session.events),
+                                                    std::make_unique<LensSolver>(session.header.mass, session.header.lensZ, session.header.sourceZ,
+                                                                                 session.header.lensX, session.header.lensY)) {}
+};
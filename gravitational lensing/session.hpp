@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+
+/*
+ * session file format (text):
+ *   lensing-session <version>
+ *   source <path to the source image>
+ *   width <real width of the source in arcseconds>
+ *   solver <mass> <lens redshift> <source redshift> <lens x> <lens y>
+ *   view <dx> <dy> <showMagnification>
+ *   k <time> <key code> 0 0 <state after the event> <latency> <frame hash>
+ *   m <time> 0 <x> <y> <state after the event> <latency> <frame hash>
+ * where the state is <lens x> <lens y> <mass> <dx> <dy>
+*/
+#define SESSION_VERSION 1
+
+/**
+ * the state of the model when the recording was started
+*/
+struct SessionHeader {
+    std::string sourceFile;         // the path to the source image
+    float realWidth;                // real width of the source in arcseconds
+    double mass;                    // mass of the lens in kg
+    float lensZ, sourceZ;           // redshifts of the lens and of the source
+    double lensX, lensY;            // the lens center in radians
+    int dx, dy;                     // shift of the source in pixels
+    bool showMagnification;         // flag shows if magnification is shown
+};
+
+/**
+ * one input event and the state of the model after it was handled
+*/
+struct SessionEvent {
+    char type;                      // 'k' for the key press, 'm' for the mouse drag
+    double time;                    // time since the recording was started in seconds
+    int code;                       // key code
+    float x, y;                     // the mouse position in window coordinates
+    double lensX, lensY;            // the lens center in radians
+    double mass;                    // mass of the lens in kg
+    int dx, dy;                     // shift of the source in pixels
+    double latency;                 // time of the image recompute in seconds
+    uint64_t frame;                 // hash of the rendered frame
+};
+
+/**
+ * @return fnv-1a hash of the frame pixels
+*/
+inline uint64_t frameHash(const uint8_t *pixels, size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ pixels[i]) * 1099511628211ull;
+    return hash;
+}
+
+/**
+ * writes the input events of the session to the file
+*/
+class SessionRecorder {
+protected:
+    std::ofstream file;
+
+public:
+    /**
+     * @param filename the path to the session file
+     * @param header the state of the model before the first event
+     *
+     * @throw std::runtime_error is thrown if the file couldn't be open
+    */
+    SessionRecorder(std::string filename, const SessionHeader &header): file(filename) {
+        if (!file)
+            throw std::runtime_error("Failed to open file.");
+        file << std::setprecision(17);
+        file << "lensing-session " << SESSION_VERSION << '\n'
+             << "source " << header.sourceFile << '\n'
+             << "width " << header.realWidth << '\n'
+             << "solver " << header.mass << ' ' << header.lensZ << ' ' << header.sourceZ << ' '
+                          << header.lensX << ' ' << header.lensY << '\n'
+             << "view " << header.dx << ' ' << header.dy << ' ' << header.showMagnification << '\n';
+    }
+
+    void log(const SessionEvent &e) {
+        file << e.type << ' ' << e.time << ' ' << e.code << ' ' << e.x << ' ' << e.y << ' '
+             << e.lensX << ' ' << e.lensY << ' ' << e.mass << ' ' << e.dx << ' ' << e.dy << ' '
+             << e.latency << ' ' << e.frame << '\n';
+        file.flush();
+    }
+};
+
+/**
+ * reads the session file
+ *
+ * @param[in] filename the path to the session file
+ * @param[out] header the state of the model before the first event
+ * @param[out] events the recorded events
+ *
+ * @throw std::runtime_error is thrown if the file couldn't be open or has wrong format
+*/
+inline void readSession(std::string filename, SessionHeader &header, std::vector<SessionEvent> &events) {
+    std::ifstream file(filename);
+    std::string tag;
+    int version;
+    if (!(file >> tag >> version) || tag != "lensing-session" || version != SESSION_VERSION)
+        throw std::runtime_error("Failed to open session.");
+
+    file >> tag >> std::ws;
+    std::getline(file, header.sourceFile);
+    file >> tag >> header.realWidth;
+    file >> tag >> header.mass >> header.lensZ >> header.sourceZ >> header.lensX >> header.lensY;
+    file >> tag >> header.dx >> header.dy >> header.showMagnification;
+    if (!file)
+        throw std::runtime_error("Failed to read session header.");
+
+    SessionEvent e;
+    events.clear();
+    while (file >> e.type >> e.time >> e.code >> e.x >> e.y >> e.lensX >> e.lensY >> e.mass
+                >> e.dx >> e.dy >> e.latency >> e.frame)
+        events.push_back(e);
+}
@@ -0,0 +1,358 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include "lensSolver.hpp"
+#include "parallel.hpp"
+
+/**
+ * regular grid in the source plane
+*/
+struct SourceGrid {
+    double x0, y0;                  // coordinates of the top left corner of the grid in radians
+    double cell;                    // size of one cell in radians
+    unsigned nx, ny;                // number of cells along the axes
+};
+
+/**
+ * reconstructs the unlensed source brightness from the observed image. the lensing operator maps the source
+ * unknowns to the image pixels, the source is found as the solution of the regularized least squares problem
+ * (L^T L + lambda R^T R) s = L^T d by conjugate gradients
+*/
+class SourceReconstructor {
+protected:
+    LensSolver *solver = nullptr;   // pointer to the LensSolver object the operator is built for
+    unsigned width, height;         // size of the observed image in pixels
+    double scale;                   // scale param (ratio of real size to the number of pixels in image)
+    int dx, dy;                     // shift of the image in pixels (the same as in Renderer)
+    SourceGrid grid;                // the grid of the reconstructed source
+    unsigned maxRays = 0;           // the adaptive cell is split while it gets more rays than this (0 for pixel grid)
+    unsigned iterations = 0;        // number of iterations made by the last solve
+    double residual = 0;            // relative residual norm after the last solve
+
+    // lensing operator, every image pixel depends on at most 4 unknowns (bilinear weights)
+    std::vector<uint32_t> cols;     // indices of the unknowns, 4 per image pixel
+    std::vector<float> vals;        // weights, 4 per image pixel
+    std::vector<size_t> tRows;      // transposed operator in CSR format
+    std::vector<uint32_t> tCols;
+    std::vector<float> tVals;
+    std::vector<uint32_t> leafOf;   // index of the unknown for every cell of the grid
+    size_t unknowns = 0;            // number of unknowns
+
+    bool valid = false;             // shows if the operator corresponds to the current lens
+    double cachedMass = 0;          // lens parameters the operator was built for
+    double cachedX = 0, cachedY = 0;
+
+    /**
+     * @return true if the lens was changed since the operator was built
+    */
+    bool outdated() {
+        Point c = solver->getLensCenter();
+        return !valid || cachedMass != solver->getMass() || cachedX != c.x || cachedY != c.y;
+    }
+
+    /**
+     * splits the block of the grid into quadrants while it gets too many rays
+     *
+     * @param sat summed area table of rays number per cell
+    */
+    void split(const std::vector<uint32_t> &sat, unsigned x, unsigned y, unsigned size) {
+        if (x >= grid.nx || y >= grid.ny)
+            return;
+        unsigned x1 = std::min(x + size, grid.nx);
+        unsigned y1 = std::min(y + size, grid.ny);
+        size_t w = grid.nx + 1;
+        uint32_t rays = sat[y1 * w + x1] - sat[y * w + x1] - sat[y1 * w + x] + sat[y * w + x];
+
+        if (size > 1 && rays > maxRays) {
+            unsigned half = size / 2;
+            split(sat, x, y, half);
+            split(sat, x + half, y, half);
+            split(sat, x, y + half, half);
+            split(sat, x + half, y + half, half);
+            return;
+        }
+        for (unsigned j = y; j < y1; j++)
+            for (unsigned i = x; i < x1; i++)
+                leafOf[j * grid.nx + i] = unknowns;
+        unknowns++;
+    }
+
+    /**
+     * traces all image pixels to the source plane and fills the lensing operator
+    */
+    void build() {
+        size_t n = (size_t)width * height;
+        std::vector<float> u(n), v(n);      // positions of the traced rays in grid cells
+
+        parallelFor(0, n, [&](size_t first, size_t last) {
+            for (size_t k = first; k < last; k++) {
+                float m;
+                Point beta = solver->reverseProcessPoint(((int)(k % width) + dx) * scale, ((int)(k / width) + dy) * scale, m);
+                u[k] = (beta.x - grid.x0) / grid.cell - 0.5;
+                v[k] = (beta.y - grid.y0) / grid.cell - 0.5;
+            }
+        });
+
+        leafOf.assign((size_t)grid.nx * grid.ny, 0);
+        unknowns = 0;
+        if (maxRays) {
+            std::vector<uint32_t> sat((size_t)(grid.nx + 1) * (grid.ny + 1), 0);
+            for (size_t k = 0; k < n; k++) {
+                float i = std::round(u[k]), j = std::round(v[k]);
+                if (i >= 0 && j >= 0 && i < grid.nx && j < grid.ny)
+                    sat[((size_t)j + 1) * (grid.nx + 1) + (size_t)i + 1]++;
+            }
+            for (size_t j = 1; j <= grid.ny; j++)
+                for (size_t i = 1; i <= grid.nx; i++)
+                    sat[j * (grid.nx + 1) + i] += sat[(j - 1) * (grid.nx + 1) + i] + sat[j * (grid.nx + 1) + i - 1]
+                                                - sat[(j - 1) * (grid.nx + 1) + i - 1];
+            unsigned size = 1;
+            while (size < std::max(grid.nx, grid.ny))
+                size *= 2;
+            split(sat, 0, 0, size);
+        }
+        else
+            for (size_t i = 0; i < leafOf.size(); i++)
+                leafOf[i] = unknowns++;
+
+        cols.assign(4 * n, 0);
+        vals.assign(4 * n, 0);
+        parallelFor(0, n, [&](size_t first, size_t last) {
+            for (size_t k = first; k < last; k++) {
+                if (!std::isfinite(u[k]) || !std::isfinite(v[k]))
+                    continue;
+                if (maxRays) {
+                    float i = std::round(u[k]), j = std::round(v[k]);
+                    if (i >= 0 && j >= 0 && i < grid.nx && j < grid.ny) {
+                        cols[4 * k] = leafOf[(size_t)j * grid.nx + (size_t)i];
+                        vals[4 * k] = 1;
+                    }
+                    continue;
+                }
+                float i0 = std::floor(u[k]), j0 = std::floor(v[k]);
+                if (i0 < 0 || j0 < 0 || i0 + 1 >= grid.nx || j0 + 1 >= grid.ny)
+                    continue;
+                float fx = u[k] - i0, fy = v[k] - j0;
+                size_t c = (size_t)j0 * grid.nx + (size_t)i0;
+                cols[4 * k] = leafOf[c];                vals[4 * k] = (1 - fx) * (1 - fy);
+                cols[4 * k + 1] = leafOf[c + 1];        vals[4 * k + 1] = fx * (1 - fy);
+                cols[4 * k + 2] = leafOf[c + grid.nx];  vals[4 * k + 2] = (1 - fx) * fy;
+                cols[4 * k + 3] = leafOf[c + grid.nx + 1]; vals[4 * k + 3] = fx * fy;
+            }
+        });
+
+        tRows.assign(unknowns + 1, 0);
+        for (size_t k = 0; k < 4 * n; k++)
+            if (vals[k] != 0)
+                tRows[cols[k] + 1]++;
+        for (size_t i = 0; i < unknowns; i++)
+            tRows[i + 1] += tRows[i];
+        tCols.resize(tRows[unknowns]);
+        tVals.resize(tRows[unknowns]);
+        std::vector<size_t> next(tRows.begin(), tRows.end() - 1);
+        for (size_t k = 0; k < 4 * n; k++)
+            if (vals[k] != 0) {
+                tCols[next[cols[k]]] = k / 4;
+                tVals[next[cols[k]]++] = vals[k];
+            }
+
+        Point c = solver->getLensCenter();
+        cachedMass = solver->getMass();
+        cachedX = c.x;
+        cachedY = c.y;
+        valid = true;
+    }
+
+    /**
+     * calculates out = L v for the image pixels
+    */
+    void apply(const std::vector<double> &v, std::vector<double> &out) {
+        parallelFor(0, out.size(), [&](size_t first, size_t last) {
+            for (size_t k = first; k < last; k++)
+                out[k] = vals[4 * k] * v[cols[4 * k]] + vals[4 * k + 1] * v[cols[4 * k + 1]]
+                       + vals[4 * k + 2] * v[cols[4 * k + 2]] + vals[4 * k + 3] * v[cols[4 * k + 3]];
+        });
+    }
+
+    /**
+     * calculates out = L^T v for the unknowns
+    */
+    void applyTransposed(const std::vector<double> &v, std::vector<double> &out) {
+        parallelFor(0, unknowns, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++) {
+                double sum = 0;
+                for (size_t k = tRows[i]; k < tRows[i + 1]; k++)
+                    sum += tVals[k] * v[tCols[k]];
+                out[i] = sum;
+            }
+        });
+    }
+
+    /**
+     * calculates out += lambda R^T R v. the pixel grid is regularized by the gradient,
+     * the adaptive one by the brightness itself
+    */
+    void addRegularization(const std::vector<double> &v, std::vector<double> &out, double lambda) {
+        parallelFor(0, unknowns, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++) {
+                if (maxRays) {
+                    out[i] += lambda * v[i];
+                    continue;
+                }
+                unsigned x = i % grid.nx, y = i / grid.nx;
+                double sum = 0;
+                if (x > 0)              sum += v[i] - v[i - 1];
+                if (x + 1 < grid.nx)    sum += v[i] - v[i + 1];
+                if (y > 0)              sum += v[i] - v[i - grid.nx];
+                if (y + 1 < grid.ny)    sum += v[i] - v[i + grid.nx];
+                out[i] += lambda * sum;
+            }
+        });
+    }
+
+    static double dot(const std::vector<double> &a, const std::vector<double> &b) {
+        return parallelSum<double>(0, a.size(), [&](size_t first, size_t last) {
+            double sum = 0;
+            for (size_t i = first; i < last; i++)
+                sum += a[i] * b[i];
+            return sum;
+        });
+    }
+
+public:
+    /**
+     * @param solver pointer to the LensSolver object
+     * @param width the width of the observed image in pixels
+     * @param height the height of the observed image in pixels
+     * @param scale ratio of real size to the number of pixels in rad/pix
+     * @param grid the grid of the reconstructed source in radians
+     * @param dx horizontal shift of the image in pixels (the same as in Renderer)
+     * @param dy vertical shift of the image in pixels (the same as in Renderer)
+     *
+     * @throw std::invalid_argument is thrown if the grid is empty
+    */
+    SourceReconstructor(LensSolver *solver, unsigned width, unsigned height, double scale, SourceGrid grid, int dx=0, int dy=0):
+                        solver(solver), width(width), height(height), scale(scale), dx(dx), dy(dy), grid(grid)
+    {
+        if (!grid.nx || !grid.ny || grid.cell <= 0)
+            throw std::invalid_argument("Empty source grid.");
+    }
+
+    /**
+     * switches to the adaptive grid. the cells of the grid are merged into square blocks
+     * while the block gets no more than maxRays rays, so weakly magnified areas get coarser cells
+     *
+     * @param maxRays the maximum number of rays in one unsplit block (0 switches back to the pixel grid)
+    */
+    void setAdaptive(unsigned maxRays) {
+        if (this->maxRays != maxRays)
+            valid = false;
+        this->maxRays = maxRays;
+    }
+
+    /**
+     * reconstructs the source. the lensing operator is rebuilt only if the lens was changed
+     *
+     * @param image brightness of the observed image pixels (row by row)
+     * @param lambda the regularization strength
+     * @param maxIterations the maximum number of conjugate gradient iterations
+     * @param tolerance the solve stops when the relative residual norm becomes less than this value
+     *
+     * @return brightness of the source in the grid cells (row by row)
+    */
+    std::vector<float> reconstruct(const float *image, double lambda, unsigned maxIterations=200, double tolerance=1e-6) {
+        if (outdated())
+            build();
+
+        size_t n = (size_t)width * height;
+        std::vector<double> d(image, image + n), s(unknowns, 0), r(unknowns), p, Ap(unknowns), t(n);
+        applyTransposed(d, r);
+        p = r;
+
+        double bb = dot(r, r), rr = bb;
+        iterations = 0;
+        while (iterations < maxIterations && rr > tolerance * tolerance * bb) {
+            apply(p, t);
+            applyTransposed(t, Ap);
+            addRegularization(p, Ap, lambda);
+
+            double pAp = dot(p, Ap);
+            if (pAp <= 0)
+                break;
+            double alpha = rr / pAp;
+            parallelFor(0, unknowns, [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; i++) {
+                    s[i] += alpha * p[i];
+                    r[i] -= alpha * Ap[i];
+                }
+            });
+
+            double rrNew = dot(r, r);
+            double beta = rrNew / rr;
+            rr = rrNew;
+            parallelFor(0, unknowns, [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; i++)
+                    p[i] = r[i] + beta * p[i];
+            });
+            iterations++;
+        }
+        residual = bb > 0 ? std::sqrt(rr / bb) : 0;
+
+        std::vector<float> result(leafOf.size());
+        for (size_t i = 0; i < leafOf.size(); i++)
+            result[i] = s[leafOf[i]];
+        return result;
+    }
+
+    /**
+     * reconstructs the source from the image with several channels. the brightness of the pixel is its mean value
+     *
+     * @param pixels pointer to the pixels data (for example, sf::Image::getPixelsPtr())
+     * @param channels number of bytes per pixel
+     *
+     * @overload
+    */
+    std::vector<float> reconstruct(const uint8_t *pixels, unsigned channels, double lambda, unsigned maxIterations=200, double tolerance=1e-6) {
+        std::vector<float> image((size_t)width * height);
+        unsigned colors = std::min(channels, 3u);
+        for (size_t k = 0; k < image.size(); k++) {
+            float sum = 0;
+            for (unsigned c = 0; c < colors; c++)
+                sum += pixels[k * channels + c];
+            image[k] = sum / colors;
+        }
+        return reconstruct(image.data(), lambda, maxIterations, tolerance);
+    }
+
+    /**
+     * @return number of iterations made by the last solve
+    */
+    unsigned getIterations() {
+        return iterations;
+    }
+
+    /**
+     * @return relative residual norm after the last solve
+    */
+    double getResidual() {
+        return residual;
+    }
+
+    /**
+     * @return number of unknowns in the last built operator
+    */
+    size_t getUnknowns() {
+        return unknowns;
+    }
+
+    /**
+     * @return the grid of the reconstructed source
+    */
+    SourceGrid getGrid() {
+        return grid;
+    }
+};
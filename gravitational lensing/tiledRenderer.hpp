@@ -0,0 +1,420 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <utility>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include "lensSolver.hpp"
+#include "parallel.hpp"
+
+/*
+ * raw tiled image format:
+ *   header      "LTIL", version, width, height, tile size (uint32 each)
+ *   index       uint64 offset of every tile in the file (row by row of tiles, 0 if the tile was not written)
+ *   tiles       tileSize * tileSize RGBA pixels each (edge tiles are padded to the full size)
+*/
+#define TILED_MAGIC     0x4c49544c      // "LTIL"
+#define TILED_VERSION   1
+
+struct TiledHeader {
+    uint32_t magic, version;
+    uint32_t width, height;         // size of the image in pixels
+    uint32_t tileSize;              // size of the square tile in pixels
+
+    uint32_t tilesX() const {
+        return (width + tileSize - 1) / tileSize;
+    }
+
+    uint32_t tilesY() const {
+        return (height + tileSize - 1) / tileSize;
+    }
+
+    size_t tileBytes() const {
+        return (size_t)tileSize * tileSize * 4;
+    }
+};
+
+/**
+ * writes the tiled image tile by tile. tiles can be written in any order and from several threads
+*/
+class TiledImageWriter {
+protected:
+    std::ofstream file;
+    TiledHeader header;
+    std::vector<uint64_t> index;    // offsets of the written tiles
+    uint64_t end;                   // offset of the end of the file
+    std::mutex lock;
+
+public:
+    /**
+     * @param filename the path to the output file
+     * @param width the width of the image in pixels
+     * @param height the height of the image in pixels
+     * @param tileSize the size of the square tile in pixels
+     *
+     * @throw std::runtime_error is thrown if the file couldn't be open
+    */
+    TiledImageWriter(std::string filename, unsigned width, unsigned height, unsigned tileSize):
+                     file(filename, std::ios::binary | std::ios::trunc), header{TILED_MAGIC, TILED_VERSION, width, height, tileSize}
+    {
+        if (!file)
+            throw std::runtime_error("Failed to open file.");
+        index.assign((size_t)header.tilesX() * header.tilesY(), 0);
+        file.write((const char *)&header, sizeof(header));
+        file.write((const char *)index.data(), index.size() * sizeof(uint64_t));
+        end = sizeof(header) + index.size() * sizeof(uint64_t);
+    }
+
+    /**
+     * @param tx horizontal index of the tile
+     * @param ty vertical index of the tile
+     * @param pixels tileSize * tileSize RGBA pixels of the tile
+    */
+    void writeTile(unsigned tx, unsigned ty, const uint8_t *pixels) {
+        std::lock_guard<std::mutex> guard(lock);
+        file.seekp(end);
+        file.write((const char *)pixels, header.tileBytes());
+        if (!file)
+            throw std::runtime_error("Failed to write tile.");
+        index[(size_t)ty * header.tilesX() + tx] = end;
+        end += header.tileBytes();
+    }
+
+    /**
+     * writes the index of the tiles and closes the file
+    */
+    void close() {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!file.is_open())
+            return;
+        file.seekp(sizeof(header));
+        file.write((const char *)index.data(), index.size() * sizeof(uint64_t));
+        file.close();
+    }
+
+    TiledHeader getHeader() {
+        return header;
+    }
+
+    ~TiledImageWriter() {
+        close();
+    }
+};
+
+/**
+ * reads tiles of the tiled image
+*/
+class TiledImageReader {
+protected:
+    int fd = -1;
+    TiledHeader header;
+    std::vector<uint64_t> index;    // offsets of the tiles
+
+    bool read(void *buffer, size_t size, uint64_t offset) {
+        return pread(fd, buffer, size, offset) == (ssize_t)size;
+    }
+
+public:
+    /**
+     * @param filename the path to the tiled image
+     *
+     * @throw std::runtime_error is thrown if the file couldn't be open or has wrong format
+    */
+    TiledImageReader(std::string filename): fd(open(filename.c_str(), O_RDONLY)) {
+        if (fd < 0 || !read(&header, sizeof(header), 0) || header.magic != TILED_MAGIC || header.version != TILED_VERSION) {
+            if (fd >= 0)
+                ::close(fd);
+            throw std::runtime_error("Failed to open tiled image.");
+        }
+        index.resize((size_t)header.tilesX() * header.tilesY());
+        if (!read(index.data(), index.size() * sizeof(uint64_t), sizeof(header))) {
+            ::close(fd);
+            throw std::runtime_error("Failed to open tiled image.");
+        }
+    }
+
+    TiledImageReader(const TiledImageReader&) = delete;
+    TiledImageReader& operator=(const TiledImageReader&) = delete;
+
+    /**
+     * reads the tile, it can be called from several threads at once
+     *
+     * @param tx horizontal index of the tile
+     * @param ty vertical index of the tile
+     * @param[out] pixels buffer where tileSize * tileSize RGBA pixels will be set (black if the tile wasn't written)
+    */
+    void readTile(unsigned tx, unsigned ty, uint8_t *pixels) {
+        uint64_t offset = index[(size_t)ty * header.tilesX() + tx];
+        if (!offset) {
+            memset(pixels, 0, header.tileBytes());
+            return;
+        }
+        if (!read(pixels, header.tileBytes(), offset))
+            throw std::runtime_error("Failed to read tile.");
+    }
+
+    TiledHeader getHeader() {
+        return header;
+    }
+
+    ~TiledImageReader() {
+        ::close(fd);
+    }
+};
+
+/**
+ * writes one row of tiles
+ *
+ * @param writer the writer of the tiled image
+ * @param band RGBA pixels of the rows of the image covered by the row of tiles
+ * @param rows number of rows in the band (less than the tile size for the last band)
+ * @param ty vertical index of the row of tiles
+*/
+inline void writeTiledBand(TiledImageWriter &writer, const uint8_t *band, unsigned rows, unsigned ty) {
+    TiledHeader header = writer.getHeader();
+    unsigned tileSize = header.tileSize;
+    std::vector<uint8_t> tile(header.tileBytes());
+    for (unsigned tx = 0; tx < header.tilesX(); tx++) {
+        std::fill(tile.begin(), tile.end(), 0);
+        unsigned w = std::min(tileSize, header.width - tx * tileSize);
+        for (unsigned y = 0; y < rows; y++)
+            memcpy(tile.data() + 4 * y * tileSize, band + 4 * ((size_t)y * header.width + tx * tileSize), 4 * w);
+        writer.writeTile(tx, ty, tile.data());
+    }
+}
+
+/**
+ * converts the image to the tiled format
+ *
+ * @param pixels RGBA pixels of the image
+ * @param width the width of the image in pixels
+ * @param height the height of the image in pixels
+ * @param filename the path to the output file
+ * @param tileSize the size of the square tile in pixels
+*/
+inline void writeTiled(const uint8_t *pixels, unsigned width, unsigned height, std::string filename, unsigned tileSize=256) {
+    TiledImageWriter writer(filename, width, height, tileSize);
+    for (unsigned ty = 0; ty < writer.getHeader().tilesY(); ty++)
+        writeTiledBand(writer, pixels + 4 * (size_t)ty * tileSize * width, std::min(tileSize, height - ty * tileSize), ty);
+}
+
+/**
+ * converts the binary PPM (P6) image to the tiled format. the image is read by bands of tileSize rows,
+ * so the images larger than the memory can be converted
+ *
+ * @param image the path to the PPM image
+ * @param filename the path to the output file
+ * @param tileSize the size of the square tile in pixels
+ *
+ * @throw std::runtime_error is thrown if the image couldn't be open or has unsupported format
+*/
+inline void convertTiled(std::string image, std::string filename, unsigned tileSize=256) {
+    std::ifstream file(image, std::ios::binary);
+    std::string magic;
+    unsigned values[3];                 // width, height and the maximum color value
+    file >> magic;
+    for (unsigned &value : values) {
+        while (file >> std::ws && file.peek() == '#')
+            file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        file >> value;
+    }
+    if (!file || magic != "P6" || !values[0] || !values[1] || values[2] != 255)
+        throw std::runtime_error("Unsupported PPM image.");
+    file.get();                         // the single whitespace before the pixels
+
+    unsigned width = values[0], height = values[1];
+    TiledImageWriter writer(filename, width, height, tileSize);
+    std::vector<uint8_t> rgb((size_t)3 * width * tileSize), band((size_t)4 * width * tileSize);
+    for (unsigned ty = 0; ty < writer.getHeader().tilesY(); ty++) {
+        unsigned rows = std::min(tileSize, height - ty * tileSize);
+        if (!file.read((char *)rgb.data(), (size_t)3 * width * rows))
+            throw std::runtime_error("Failed to read PPM image.");
+        for (size_t k = 0; k < (size_t)width * rows; k++) {
+            memcpy(band.data() + 4 * k, rgb.data() + 3 * k, 3);
+            band[4 * k + 3] = 255;
+        }
+        writeTiledBand(writer, band.data(), rows, ty);
+    }
+}
+
+/**
+ * keeps the recently used tiles of the tiled image in memory. the least recently used tile is evicted
+ * when the capacity is reached
+*/
+class TileCache {
+public:
+    typedef std::shared_ptr<const std::vector<uint8_t>> Tile;
+
+protected:
+    TiledImageReader reader;
+    size_t capacity;                // the maximum number of tiles in memory
+    std::list<uint64_t> order;      // keys of the tiles from the most recently used one
+    std::unordered_map<uint64_t, std::pair<Tile, std::list<uint64_t>::iterator>> tiles;
+    std::mutex lock;
+    size_t misses = 0;              // number of tiles loaded from the disk
+
+public:
+    /**
+     * @param filename the path to the tiled image
+     * @param capacity the maximum number of tiles kept in memory
+    */
+    TileCache(std::string filename, size_t capacity): reader(filename), capacity(std::max<size_t>(capacity, 1)) {}
+
+    /**
+     * @return the tile, it stays valid even if it is evicted from the cache
+    */
+    Tile get(unsigned tx, unsigned ty) {
+        uint64_t key = (uint64_t)ty << 32 | tx;
+        std::unique_lock<std::mutex> guard(lock);
+
+        auto it = tiles.find(key);
+        if (it != tiles.end()) {
+            order.splice(order.begin(), order, it->second.second);
+            return it->second.first;
+        }
+
+        // the tile is read without the lock, so the other threads can use the cached tiles meanwhile
+        guard.unlock();
+        auto tile = std::make_shared<std::vector<uint8_t>>(reader.getHeader().tileBytes());
+        reader.readTile(tx, ty, tile->data());
+        guard.lock();
+
+        misses++;
+        it = tiles.find(key);
+        if (it != tiles.end()) {     // another thread has read the same tile
+            order.splice(order.begin(), order, it->second.second);
+            return it->second.first;
+        }
+        if (tiles.size() >= capacity) {
+            tiles.erase(order.back());
+            order.pop_back();
+        }
+        order.push_front(key);
+        tiles[key] = {tile, order.begin()};
+        return tile;
+    }
+
+    TiledHeader getHeader() {
+        return reader.getHeader();
+    }
+
+    size_t getMisses() {
+        return misses;
+    }
+};
+
+/**
+ * renders the lensed image of the tiled source straight to the tiled file. only the output tiles being processed,
+ * one source tile per thread and the cached source tiles are kept in memory, so the size of the output is bounded
+ * by the disk only
+*/
+class TiledRenderer {
+protected:
+    LensSolver *solver = nullptr;   // pointer the LensSolver object will be used in calculations
+    TileCache &source;              // cache of the source tiles
+    double scale;                   // scale of the output in rad/pix
+    double sourceScale;             // scale of the source in rad/pix
+    int dx, dy;                     // shift of the output in pixels
+    bool showMagnification = true;  // flag shows if the colors will be magnified
+
+    /**
+     * renders one output tile. the pixels are grouped by the source tile they map to, and the source tiles
+     * are loaded through the cache and released one by one, so the thread holds only one source tile at a time
+    */
+    void renderTile(TiledHeader out, unsigned tx, unsigned ty, std::vector<int32_t> &u, std::vector<int32_t> &v,
+                    std::vector<float> &magn, std::vector<std::pair<uint64_t, uint32_t>> &order, std::vector<uint8_t> &pixels)
+    {
+        TiledHeader src = source.getHeader();
+        unsigned size = out.tileSize;
+        unsigned srcTiles = src.tilesX();
+        order.clear();
+
+        for (unsigned y = 0; y < size; y++)
+            for (unsigned x = 0; x < size; x++) {
+                size_t k = (size_t)y * size + x;
+                float m = 1.0;
+                Point p = solver->reverseProcessPoint((int)(tx * size + x + dx) * scale, (int)(ty * size + y + dy) * scale, m) / sourceScale;
+                magn[k] = !showMagnification ? 1 : (m > 2) ? 2 : (m < 0.25) ? 0.25 : m;
+                uint8_t *color = pixels.data() + 4 * k;
+                color[0] = color[1] = color[2] = 0;
+                color[3] = 255;
+                if (!(p.x >= 1 && p.x < src.width && p.y >= 1 && p.y < src.height))
+                    continue;
+                u[k] = (int32_t)p.x;
+                v[k] = (int32_t)p.y;
+                order.push_back({(uint64_t)(v[k] / src.tileSize) * srcTiles + u[k] / src.tileSize, (uint32_t)k});
+            }
+        std::sort(order.begin(), order.end());
+
+        for (size_t i = 0; i < order.size();) {
+            uint64_t key = order[i].first;
+            TileCache::Tile tile = source.get(key % srcTiles, key / srcTiles);
+            for (; i < order.size() && order[i].first == key; i++) {
+                size_t k = order[i].second;
+                unsigned sx = u[k], sy = v[k];
+                const uint8_t *c = tile->data() + 4 * ((size_t)(sy % src.tileSize) * src.tileSize + sx % src.tileSize);
+                uint8_t *color = pixels.data() + 4 * k;
+                for (int j = 0; j < 3; j++) {
+                    int colorComponent = c[j] * magn[k];
+                    color[j] = colorComponent > 255 ? 255 : colorComponent;
+                }
+            }
+        }
+    }
+
+public:
+    /**
+     * @param solver pointer to the LensSolver object
+     * @param source cache of the tiled source image
+     * @param scale scale of the output in rad/pix
+     * @param sourceScale scale of the source in rad/pix
+     * @param dx horizontal shift of the output in pixels
+     * @param dy vertical shift of the output in pixels
+    */
+    TiledRenderer(LensSolver *solver, TileCache &source, double scale, double sourceScale, int dx=0, int dy=0):
+                  solver(solver), source(source), scale(scale), sourceScale(sourceScale), dx(dx), dy(dy) {}
+
+    void setShowMagnification(bool show) {
+        showMagnification = show;
+    }
+
+    /**
+     * renders the lensed image to the tiled file
+     *
+     * @param filename the path to the output file
+     * @param width the width of the output in pixels
+     * @param height the height of the output in pixels
+     * @param tileSize the size of the output tile in pixels
+     * @param threads number of threads (0 means all available cores)
+    */
+    void render(std::string filename, unsigned width, unsigned height, unsigned tileSize=256, unsigned threads=0) {
+        TiledImageWriter writer(filename, width, height, tileSize);
+        TiledHeader out = writer.getHeader();
+        size_t tiles = (size_t)out.tilesX() * out.tilesY();
+        size_t n = (size_t)tileSize * tileSize;
+
+        parallelFor(0, tiles, [&](size_t first, size_t last) {
+            std::vector<int32_t> u(n), v(n);
+            std::vector<float> magn(n);
+            std::vector<std::pair<uint64_t, uint32_t>> order;
+            order.reserve(n);
+            std::vector<uint8_t> pixels(4 * n);
+            for (size_t t = first; t < last; t++) {
+                renderTile(out, t % out.tilesX(), t / out.tilesX(), u, v, magn, order, pixels);
+                writer.writeTile(t % out.tilesX(), t / out.tilesX(), pixels.data());
+            }
+        }, threads);
+        writer.close();
+    }
+};